@@ -0,0 +1,85 @@
+// accounting.h
+#ifndef ACCOUNTING_H
+#define ACCOUNTING_H
+
+#include <stdint.h>
+
+// What a sender spends its time on.
+enum SendPhase {
+    PHASE_SENDING,          // writing a frame to the channel
+    PHASE_WAIT_ACK,         // waiting for the echo of a frame
+    PHASE_BACKOFF,          // waiting before retransmitting a frame
+    PHASE_POST_ACK,         // waiting one slot after an ACK
+    PHASE_IDLE,             // waiting for the next frame to be generated
+    PHASE_DONE,             // finished; not accounted
+    NUM_PHASES = PHASE_DONE,
+};
+
+// Names of the accounted phases, as printed in reports.
+const char* const phase_names[NUM_PHASES] = {"sending", "waiting for ACK", "backoff", "post-ACK", "idle"};
+
+// Byte-accurate account of what a sender wrote to and read from the channel.
+struct ByteAccounting {
+    uint64_t goodput_bytes = 0;         // payload bytes of acked frames, each frame counted once
+    uint64_t goodput_frames = 0;
+    uint64_t wire_bytes = 0;            // bytes written to the channel, headers and retransmissions included
+    uint64_t wire_frames = 0;
+    uint64_t received_bytes = 0;        // bytes read from the channel (ACKs, noise and other senders' broadcasts)
+    uint64_t received_frames = 0;
+    uint64_t discarded_bytes = 0;       // received bytes that were neither an ACK nor noise on the sender's sub-channel
+    uint64_t discarded_frames = 0;
+    int64_t phase_us[NUM_PHASES] = {};  // time spent in each phase
+    SendPhase phase = PHASE_DONE;       // current phase
+    int64_t phase_since_us = 0;         // when the current phase started
+};
+
+// Records a frame of `wire_size` bytes written to the channel.
+inline void account_sent(ByteAccounting& account, uint64_t wire_size) {
+    account.wire_bytes += wire_size;
+    account.wire_frames++;
+}
+
+// Records a frame of `wire_size` bytes read from the channel, which the
+// sender used (as an ACK or as noise) or discarded.
+inline void account_received(ByteAccounting& account, uint64_t wire_size, bool used) {
+    account.received_bytes += wire_size;
+    account.received_frames++;
+    if (used) return;
+    account.discarded_bytes += wire_size;
+    account.discarded_frames++;
+}
+
+// Records the ACK of a frame with `payload_length` bytes of payload.
+inline void account_acked(ByteAccounting& account, uint64_t payload_length) {
+    account.goodput_bytes += payload_length;
+    account.goodput_frames++;
+}
+
+// Gets the current time, in microseconds.
+// Charges the time since the current phase started to it, and starts `phase`.
+inline void account_phase(ByteAccounting& account, SendPhase phase, int64_t now_us) {
+    if (account.phase != PHASE_DONE) account.phase_us[account.phase] += now_us - account.phase_since_us;
+    account.phase = phase;
+    account.phase_since_us = now_us;
+}
+
+// Adds the counts of `part` (e.g. one stripe) to `total`.
+inline void merge_accounting(ByteAccounting& total, const ByteAccounting& part) {
+    total.goodput_bytes += part.goodput_bytes;
+    total.goodput_frames += part.goodput_frames;
+    total.wire_bytes += part.wire_bytes;
+    total.wire_frames += part.wire_frames;
+    total.received_bytes += part.received_bytes;
+    total.received_frames += part.received_frames;
+    total.discarded_bytes += part.discarded_bytes;
+    total.discarded_frames += part.discarded_frames;
+    for (int p = 0; p < NUM_PHASES; p++) total.phase_us[p] += part.phase_us[p];
+}
+
+// Gets a number of bytes and the time they took, in microseconds.
+// Returns the rate in megabits per second, or 0 if no time passed.
+inline double rate_mbps(uint64_t bytes, int64_t duration_us) {
+    return duration_us > 0 ? bytes * 8.0 / duration_us : 0;
+}
+
+#endif
@@ -0,0 +1,407 @@
+// bridge.cpp
+#include "protocol.h"
+#include "fec.h"
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <string>
+#include <random>
+#include <unordered_map>
+#include <map>
+#include <algorithm>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <signal.h>
+
+using namespace std;
+
+#define MAX_QUEUE_FRAMES 1024
+#define MAX_ATTEMPTS 10
+// Most data frames of each source kept to decode its FEC blocks with.
+#define FEC_KEEP_FRAMES FEC_MAX_SHARDS
+// Most FEC blocks of each source whose repair frames are kept at a time.
+#define FEC_KEEP_BLOCKS 8
+
+// A channel (collision domain) the bridge is attached to.
+struct Domain {
+    string name;                // "ip:port" of the channel
+    int sockfd;                 // -1 once the channel closed the connection
+    deque<Frame> queue;         // frames waiting to be forwarded into this domain
+    bool awaiting_echo = false; // the head of the queue was sent and not echoed yet
+    int attempts = 0;           // transmissions of the head of the queue
+    timeval deadline{0, 0};     // end of the current ACK wait or backoff
+    // Statistics.
+    int received = 0;           // data frames heard on this domain
+    int forwarded = 0;          // frames delivered into this domain by the bridge
+    int filtered = 0;           // frames whose destination is in their own domain
+    int flooded = 0;            // frames sent to all other domains (unknown destination)
+    int dropped = 0;            // frames dropped (full queue or MAX_ATTEMPTS)
+    int collisions = 0;
+    int fec_rebuilt = 0;        // lost data frames rebuilt from the repair frames heard on this domain
+    int fec_repeats = 0;        // retransmissions of rebuilt frames, not forwarded again
+};
+
+// A data frame the bridge heard (or rebuilt) from a source that may protect it with FEC.
+struct HeardFrame {
+    Frame frame;
+    bool rebuilt = false;
+};
+
+// The repair frames heard of one FEC block.
+struct RepairSet {
+    FrameHeader header;                 // header of the first repair frame, for the rebuilt frames
+    FecHeader fec;
+    vector<uint32_t> seqs;              // sequence numbers of the block's data frames
+    vector<int> indices;                // index of each repair shard among the block's shards
+    vector<vector<uint8_t>> shards;
+    bool decoded = false;               // every data frame of the block was heard or rebuilt
+};
+
+// What the bridge heard from one source, to decode its FEC blocks.
+struct FecSource {
+    unordered_map<uint32_t, HeardFrame> frames;     // data frames by sequence number
+    deque<uint32_t> order;                          // their sequence numbers, oldest first
+    map<uint32_t, RepairSet> blocks;                // repair frames by block number
+};
+
+// All the domains the bridge is attached to.
+vector<Domain> domains;
+
+// Learning table: the domain each known source_id lives in.
+unordered_map<uint64_t, int> table;
+
+// The frames heard from each source living in one of the domains, by source_id.
+unordered_map<uint64_t, FecSource> fec_sources;
+
+// Gets "ip:port".
+// Connects to the channel at that address and returns the socket.
+int connect_to_channel(const string& address) {
+    size_t colon = address.rfind(':');
+    string ip = address.substr(0, colon);
+    int port = stoi(address.substr(colon + 1));
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, ip.c_str(), &addr.sin_addr);
+    while (connect(sock, (sockaddr*)&addr, sizeof(addr)) == -1) {}
+    return sock;
+}
+
+// Gets a domain and a number of milliseconds.
+// Sets the domain's deadline to that time from now.
+void set_deadline(Domain& domain, int time_ms) {
+    timeval now, wait_time{time_ms / 1000, (time_ms % 1000) * 1000};
+    gettimeofday(&now, nullptr);
+    timeradd(&now, &wait_time, &domain.deadline);
+}
+
+// Gets a frame heard on domain `from`.
+// Learns where its source lives, and queues it on the domains it must reach.
+void forward_frame(const Frame& frame, int from) {
+    uint64_t source = id_to_key(frame.header.source_id);
+    auto known_source = table.find(source);
+    // A frame from a source that lives elsewhere is a copy the bridge injected itself.
+    if (known_source != table.end() && known_source->second != from) return;
+    table[source] = from;
+    domains[from].received++;
+
+    // Find the domains the frame must reach.
+    vector<int> targets;
+    auto known_dest = table.find(id_to_key(frame.header.dest_id));
+    if (known_dest != table.end()) {
+        if (known_dest->second == from) {
+            domains[from].filtered++;
+            return;
+        }
+        targets.push_back(known_dest->second);
+    } else {
+        for (int d = 0; d < (int)domains.size(); d++) {
+            if (d != from) targets.push_back(d);
+        }
+        domains[from].flooded++;
+    }
+
+    for (int d : targets) {
+        if (domains[d].sockfd < 0 || domains[d].queue.size() >= MAX_QUEUE_FRAMES) {
+            domains[d].dropped++;
+            continue;
+        }
+        domains[d].queue.push_back(frame);
+    }
+}
+
+// Gets a source and a data frame of it.
+// Keeps the frame to decode the source's blocks with, dropping the oldest beyond FEC_KEEP_FRAMES.
+void keep_frame(FecSource& source, const Frame& frame, bool rebuilt) {
+    uint32_t seq = frame.header.seq_number;
+    if (source.frames.find(seq) == source.frames.end()) {
+        source.order.push_back(seq);
+        if (source.order.size() > FEC_KEEP_FRAMES) {
+            source.frames.erase(source.order.front());
+            source.order.pop_front();
+        }
+    }
+    source.frames[seq] = HeardFrame{frame, rebuilt};
+}
+
+// Gets a source, one of its blocks and the domain the source lives in.
+// Once the data frames and repair frames heard of the block are enough,
+// rebuilds the data frames that were lost, and forwards them like the frames heard.
+void decode_repairs(FecSource& source, RepairSet& block, int from) {
+    if (block.decoded) return;
+    int k = block.fec.k;
+    size_t size = block.shards[0].size();
+    vector<int> indices;
+    vector<vector<uint8_t>> heard;
+    vector<int> missing;
+    for (int i = 0; i < k; i++) {
+        auto known = source.frames.find(block.seqs[i]);
+        if (known == source.frames.end() || FEC_LENGTH_SIZE + known->second.frame.header.payload_length > size) {
+            missing.push_back(i);
+            continue;
+        }
+        indices.push_back(i);
+        heard.push_back(fec_shard(known->second.frame, size));
+    }
+    if (missing.empty()) {
+        block.decoded = true;
+        return;
+    }
+    vector<const uint8_t*> shards;
+    for (auto& shard : heard) shards.push_back(shard.data());
+    for (size_t j = 0; j < block.shards.size() && (int)indices.size() < k; j++) {
+        indices.push_back(block.indices[j]);
+        shards.push_back(block.shards[j].data());
+    }
+    vector<vector<uint8_t>> data;
+    if (!fec_decode(k, indices, shards, size, data)) return;
+    block.decoded = true;
+    for (int i : missing) {
+        Frame frame;
+        frame.header = block.header;
+        frame.header.payload_type = DATA_FLAG;
+        frame.header.seq_number = block.seqs[i];
+        if (!fec_unshard(data[i], frame)) continue;
+        keep_frame(source, frame, true);
+        domains[from].fec_rebuilt++;
+        forward_frame(frame, from);
+    }
+}
+
+// Gets a frame heard on domain `from` and forwarded.
+// Keeps it if its source lives there: a data frame to decode the source's
+// blocks with, or the shard of a repair frame. Then decodes the blocks it
+// may complete.
+void receive_fec(const Frame& frame, int from) {
+    uint64_t key = id_to_key(frame.header.source_id);
+    auto known_source = table.find(key);
+    if (known_source == table.end() || known_source->second != from) return;
+    FecSource& source = fec_sources[key];
+    if (!is_repair_frame(frame)) {
+        keep_frame(source, frame, false);
+        for (auto& entry : source.blocks) {
+            vector<uint32_t>& seqs = entry.second.seqs;
+            if (find(seqs.begin(), seqs.end(), frame.header.seq_number) != seqs.end()) {
+                decode_repairs(source, entry.second, from);
+            }
+        }
+        return;
+    }
+    FecHeader fec;
+    vector<uint32_t> seqs;
+    const uint8_t* shard = parse_repair_frame(frame, fec, seqs);
+    if (shard == nullptr || fec.index >= fec.r || fec.k + fec.r > FEC_MAX_SHARDS) return;
+    size_t size = frame.header.payload_length - fec_repair_overhead(fec.k);
+    RepairSet& block = source.blocks[fec.block];
+    if (block.shards.empty()) {
+        block.header = frame.header;
+        block.fec = fec;
+        block.seqs = seqs;
+    } else if (block.fec.k != fec.k || block.seqs != seqs || block.shards[0].size() != size) {
+        return;
+    }
+    int index = fec.k + fec.index;
+    for (int known : block.indices) {
+        if (known == index) return;
+    }
+    block.indices.push_back(index);
+    block.shards.emplace_back(shard, shard + size);
+    if (source.blocks.size() > FEC_KEEP_BLOCKS) source.blocks.erase(source.blocks.begin());
+    if (source.blocks.count(fec.block)) decode_repairs(source, source.blocks[fec.block], from);
+}
+
+// Gets a frame heard on domain `from`.
+// Returns true if it retransmits a data frame the bridge already rebuilt and forwarded.
+bool repeats_rebuilt(const Frame& frame, int from) {
+    uint64_t key = id_to_key(frame.header.source_id);
+    auto known_source = table.find(key);
+    if (is_repair_frame(frame) || known_source == table.end() || known_source->second != from) return false;
+    auto source = fec_sources.find(key);
+    if (source == fec_sources.end()) return false;
+    auto known = source->second.frames.find(frame.header.seq_number);
+    if (known == source->second.frames.end() || !known->second.rebuilt) return false;
+    domains[from].fec_repeats++;
+    return true;
+}
+
+// Gets a domain whose channel closed the connection (or failed).
+// Detaches the bridge from it, dropping the frames queued for it.
+void close_domain(Domain& domain) {
+    cerr << "Domain " << domain.name << ": channel closed" << endl;
+    close(domain.sockfd);
+    domain.sockfd = -1;
+    domain.dropped += domain.queue.size();
+    domain.queue.clear();
+    domain.awaiting_echo = false;
+}
+
+// Gets the slot time and the ACK timeout.
+// Forwards frames between the attached domains, contending for each channel
+// like a regular server, until the user pressed CTRL+D (EOF) or every
+// channel closed.
+void bridge_loop(int slot_time, int timeout_ms, int seed) {
+    default_random_engine rng(seed);
+    fcntl(STDIN_FILENO, F_SETFL, O_NONBLOCK);
+
+    while (true) {
+        // Transmit the head of each idle domain's queue whose backoff is over.
+        timeval now;
+        gettimeofday(&now, nullptr);
+        for (auto& domain : domains) {
+            if (domain.queue.empty()) continue;
+            bool expired = !timercmp(&now, &domain.deadline, <);
+            if (domain.awaiting_echo && expired) {
+                // No echo in time; count the attempt as failed and back off.
+                domain.awaiting_echo = false;
+                set_deadline(domain, uniform_int_distribution<int>(0, (1 << min(domain.attempts, 10)) - 1)(rng) * slot_time);
+                continue;
+            }
+            if (domain.awaiting_echo || !expired) continue;
+            if (domain.attempts >= MAX_ATTEMPTS) {
+                domain.queue.pop_front();
+                domain.attempts = 0;
+                domain.dropped++;
+                continue;
+            }
+            Frame& frame = domain.queue.front();
+            send(domain.sockfd, &frame, sizeof(FrameHeader) + frame.header.payload_length, 0);
+            domain.attempts++;
+            domain.awaiting_echo = true;
+            set_deadline(domain, timeout_ms);
+        }
+
+        // Listen to stdin and all the channels for one slot.
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(STDIN_FILENO, &fds);
+        int maxfd = STDIN_FILENO;
+        int open = 0;
+        for (auto& domain : domains) {
+            if (domain.sockfd < 0) continue;
+            FD_SET(domain.sockfd, &fds);
+            maxfd = max(maxfd, domain.sockfd);
+            open++;
+        }
+        if (open == 0) break;
+        timeval tv{0, slot_time * 1000};
+        if (select(maxfd + 1, &fds, nullptr, nullptr, &tv) <= 0) continue;
+
+        // If got EOF in stdin, stop program.
+        if (FD_ISSET(STDIN_FILENO, &fds)) {
+            char buff;
+            if (read(STDIN_FILENO, &buff, sizeof buff) == 0) break;
+        }
+
+        for (int d = 0; d < (int)domains.size(); d++) {
+            Domain& domain = domains[d];
+            if (domain.sockfd < 0 || !FD_ISSET(domain.sockfd, &fds)) continue;
+            Frame frame;
+            int res = recv_frame(domain.sockfd, frame);
+            if (res <= 0) {
+                // EOF or a broken stream: the socket would stay readable forever.
+                close_domain(domain);
+                continue;
+            }
+            // The bridge does not take part in tree splitting; slot feedback is for the channel's servers.
+            if (is_feedback_frame(frame)) continue;
+
+            if (is_defer_frame(frame)) {
+                // Another sender holds the medium for a burst: wait it out without counting an attempt.
+                if (domain.awaiting_echo) {
+                    domain.awaiting_echo = false;
+                    domain.attempts--;
+                    set_deadline(domain, defer_slots(frame) * slot_time);
+                }
+                continue;
+            }
+
+            if (is_noise_frame(frame)) {
+                // A collision; if the bridge was transmitting, back off.
+                if (domain.awaiting_echo) {
+                    domain.awaiting_echo = false;
+                    domain.collisions++;
+                    set_deadline(domain, uniform_int_distribution<int>(0, (1 << min(domain.attempts, 10)) - 1)(rng) * slot_time);
+                }
+                continue;
+            }
+
+            // The echo of the frame the bridge sent means it was delivered.
+            if (domain.awaiting_echo && !domain.queue.empty() &&
+                memcmp(frame.header.source_id, domain.queue.front().header.source_id, 6) == 0 &&
+                frame.header.seq_number == domain.queue.front().header.seq_number) {
+                domain.queue.pop_front();
+                domain.awaiting_echo = false;
+                domain.attempts = 0;
+                domain.forwarded++;
+                set_deadline(domain, slot_time);
+                continue;
+            }
+            // Re-ACKs are meant for the bridge alone; there is nothing to forward.
+            if (is_reack_frame(frame)) continue;
+            // The sender cannot know the bridge rebuilt a frame, so it retransmits it.
+            if (repeats_rebuilt(frame, d)) continue;
+
+            forward_frame(frame, d);
+            receive_fec(frame, d);
+        }
+    }
+}
+
+// Display statistics about every domain and the learning table.
+void report_stats() {
+    for (auto& domain : domains) {
+        cerr << "Domain " << domain.name << ": " << domain.received << " frames heard, "
+             << domain.forwarded << " forwarded into it, " << domain.flooded << " flooded, "
+             << domain.filtered << " filtered, " << domain.dropped << " dropped, "
+             << domain.collisions << " collisions";
+        if (domain.fec_rebuilt > 0 || domain.fec_repeats > 0) {
+            cerr << ", " << domain.fec_rebuilt << " lost frames rebuilt from repair frames ("
+                 << domain.fec_repeats << " retransmissions of them not forwarded)";
+        }
+        cerr << endl;
+    }
+    cerr << "Learned " << table.size() << " source IDs" << endl;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 5) {
+        cerr << "Usage: ./my_bridge <slot_time> <timeout_ms> <chan_ip:port> <chan_ip:port> [<chan_ip:port> ...]" << endl;
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    for (int i = 3; i < argc; i++) {
+        Domain domain;
+        domain.name = argv[i];
+        domain.sockfd = connect_to_channel(domain.name);
+        domains.push_back(domain);
+    }
+    bridge_loop(stoi(argv[1]), stoi(argv[2]), getpid());
+    report_stats();
+    return 0;
+}
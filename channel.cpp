@@ -1,19 +1,89 @@
 // channel.cpp
 #include "protocol.h"
+#include "timer_wheel.h"
+#include "session_log.h"
+#include "shm_stats.h"
+#include "sampler.h"
+#include "json_writer.h"
 #include <iostream>
 #include <vector>
 #include <thread>
 #include <chrono>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <random>
+#include <deque>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <arpa/inet.h>
 #include <sys/select.h>
+#include <sys/un.h>
+#include <sys/signalfd.h>
 #include <signal.h>
+#include <errno.h>
+#include <string.h>
 
 using namespace std;
 
+// How collisions between frames of different traffic classes are resolved.
+enum PriorityMode { PRIORITY_NONE, PRIORITY_STRICT, PRIORITY_WEIGHTED };
+
+// Relative chance of each traffic class to win a collision in weighted priority mode.
+const int class_weights[NUM_CLASSES] = {1, 4};
+
+// Options that may follow the positional arguments on the command line.
+struct ChannelOptions {
+    bool fair = false;          // let the most starved sender win a collision
+    PriorityMode priority = PRIORITY_NONE;
+    int seed = 1;               // seed of the channel's random decisions
+    bool switched = false;      // switch mode: per-port queues instead of a shared collision domain
+    bool slotted = false;       // frames collide when they arrive in the same slot, not the same wake
+    size_t queue_size = 64;     // capacity of each port's ingress and egress queues in switch mode
+    int subchannels = 1;        // number of independent collision domains (frequencies)
+    int slot_time = 1;          // slot duration in milliseconds (positional argument)
+    // Impairments of the links from the channel to each server.
+    double loss = 0;            // probability that a frame is lost
+    int delay = 0;              // propagation delay, in milliseconds
+    int jitter = 0;             // extra random delay of up to this many milliseconds
+    int bandwidth = 0;          // bytes per slot each link can carry; 0 means unlimited
+    double ber = 0;             // probability that each bit (outside payload_length) is flipped
+    double bucket_rate = 0;     // tokens (frames) each sender earns per slot; 0 means an equal share
+    double bucket_size = 8;     // maximum tokens a sender can accumulate
+    const char* record = nullptr;   // path of the session log to write, or null for none
+    const char* replay = nullptr;   // path of the session log to replay instead of listening
+    const char* admin = nullptr;    // path of the admin socket, or null for none
+    bool daemon = false;            // run without stdin; stop on SIGTERM/SIGINT only
+    const char* stats_log = nullptr;    // file the reports are appended to instead of stderr
+    const char* shm = nullptr;      // name of the shared-memory stats segment, or null for none
+    const char* samples = nullptr;  // file the time series of samples is written to, or null for none
+    bool samples_json = false;      // write the samples as JSON lines instead of CSV
+    bool samples_live = false;      // write every sample when it is taken instead of at exit
+    int sample_interval = 100;      // time between two samples, in milliseconds
+    const char* json = nullptr;     // file the final report is written to as JSON ("-" for stdout), or null for none
+    int idle_timeout = 0;           // evict servers silent for this many milliseconds; 0 means never
+    int keepalive = 10;             // seconds of silence before TCP keepalive probes start; 0 disables them
+    bool dedup = false;             // answer retransmissions of delivered frames with a re-ACK to their sender only
+    int burst = 1;                  // frames a sender may send per acquisition of the medium (TXOP); 1 disables bursts
+    uint32_t burst_bytes = 0;       // payload bytes a TXOP may start frames within; 0 means unlimited
+    bool tree = false;              // tree splitting: broadcast the outcome of every slot (implies slotted mode)
+};
+
+// Sequence numbers of one source that were delivered already: the highest
+// one, and which of the 64 below it.
+struct SeqWindow {
+    bool any = false;
+    uint32_t highest = 0;
+    uint64_t below = 0;         // bit i set: `highest - 1 - i` was delivered
+};
+
 // Information about a server currently or previously connected to this channel.
 struct ServerInfo {
     sockaddr_in addr;
@@ -21,11 +91,613 @@ struct ServerInfo {
     int frames = 0;
     int collisions = 0;
     bool is_dead = false;
+    uint64_t bytes = 0;         // payload bytes delivered
+    int arbitrations_won = 0;   // collisions resolved in this server's favor
+    int class_frames[NUM_CLASSES] = {};     // frames delivered per traffic class
+    double tokens = 0;          // token bucket balance; high means under its share
+    Frame frame;                // the frame received in the current slot
+    // Switch mode.
+    deque<Frame> ingress;       // frames received from this server, not switched yet
+    deque<Frame> egress;        // frames waiting to be sent to this server
+    int ingress_drops = 0;      // frames from this server dropped on a full ingress queue
+    int egress_drops = 0;       // frames to this server dropped on a full egress queue
+    size_t max_egress = 0;      // deepest the egress queue has been
+    // Impairment stage.
+    double link_free_at = 0;    // time (ms since start) the link to this server is free again
+    int lost = 0;               // frames to this server lost on the link
+    int corrupted = 0;          // frames to this server with flipped bits
+    StatSlot* stat = nullptr;   // row of this connection in the shared-memory stats, if any
+    bool backing_off = false;   // got noise for its last frame and has not sent another one since
+    // Duplicate suppression.
+    unordered_map<uint64_t, SeqWindow> delivered;   // sequence numbers delivered, per source ID
+    int duplicates = 0;         // retransmissions of delivered frames answered with a re-ACK
+    // Burst mode.
+    int burst_frames = 0;       // frames delivered within this server's TXOPs, after the one that acquired the medium
+    int deferred = 0;           // frames deferred because another server held the medium
+    // Connection health.
+    Frame rx;                   // the frame being received; frames may arrive in several pieces
+    size_t rx_len = 0;          // bytes of `rx` received so far
+    double last_heard_ms = 0;   // wake time the server last sent anything (or connected)
+    bool send_failed = false;   // a frame could not be written to it; it is evicted at the next wake
+    bool peer_closed = false;   // the write failed because the server had closed the connection
 };
 
+// Why connections ended, and how often servers' sockets misbehaved.
+struct HealthInfo {
+    int closed = 0;                 // servers that closed their connection
+    int errors = 0;                 // evicted after a receive or send error (e.g. reset, keepalive timeout)
+    int malformed = 0;              // evicted after sending an impossible frame header
+    int idle = 0;                   // evicted after the idle timeout
+    uint64_t spurious_wakeups = 0;  // readable sockets that had nothing to read
+    uint64_t partial_reads = 0;     // reads that ended in the middle of a frame
+};
+
+HealthInfo health;
+
+// Broadcast bytes not sent thanks to re-ACKs.
+uint64_t dedup_bytes_saved = 0;
+
 // All the servers that have ever connected to the channel.
 vector<ServerInfo> servers;
 
+// Options of this channel.
+ChannelOptions options;
+
+// Random number generator for the channel's decisions.
+default_random_engine rng;
+
+// Switch mode learning table: the index in `servers` of each known source_id.
+unordered_map<uint64_t, size_t> mac_table;
+
+// A frame on its way to a server through an impaired link.
+struct Delivery {
+    size_t to;                  // index in `servers`
+    Frame frame;
+};
+
+// Random number generator for the impairment stage, separate from the
+// arbitration decisions so that each stage is reproducible on its own.
+default_random_engine impair_rng;
+
+// Deliveries delayed by the impairment stage, by due time in milliseconds since start.
+TimerWheel<Delivery> deliveries;
+
+// Time the channel started, for the impairment stage's clock.
+auto channel_start = chrono::steady_clock::now();
+
+// Session log being written in record mode, or nullptr.
+FILE* session_log = nullptr;
+
+// Number of the current wake of the channel loop, for the session log.
+uint32_t wake = 0;
+
+// Time of the current wake of the channel loop, in milliseconds since the channel started.
+// All the decisions of a wake see the same time, so that a replay makes the same decisions.
+double wake_clock = 0;
+
+// Returns the time of the current wake, in milliseconds since the channel started.
+double now_ms() {
+    return wake_clock;
+}
+
+// Moves the wake clock to the current time, in whole microseconds like the session log.
+void update_wake_clock() {
+    auto elapsed = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - channel_start);
+    wake_clock = elapsed.count() / 1000.0;
+}
+
+// Gets the kind of an event, the server it concerns, its frame (if any) and
+// the new setting (for EVENT_SLOT_TIME and EVENT_MODE) or reason (for EVENT_CLOSE).
+// Appends the event to the session log, if recording.
+void record_event(uint8_t event, size_t server, const Frame* frame, uint32_t setting = 0) {
+    if (!session_log) return;
+    SessionRecord record;
+    record.time_us = (uint64_t)llround(now_ms() * 1000);
+    record.wake = wake;
+    record.server = (uint16_t)server;
+    record.event = event;
+    record.address = setting;
+    if (server < servers.size()) {
+        record.port = servers[server].addr.sin_port;
+        if (event == EVENT_CONNECT) record.address = servers[server].addr.sin_addr.s_addr;
+    }
+    if (frame) {
+        record.header = frame->header;
+        record.payload_hash = hash_payload(*frame);
+    }
+    write_session_record(session_log, record);
+}
+
+// Gets a server and a frame.
+// Sends the frame to the server; replayed servers have no socket and get nothing.
+void send_frame(ServerInfo& server, const Frame& frame) {
+    if (server.sockfd < 0 || server.is_dead) return;
+    // A failed or short write breaks the server's stream of frames.
+    if (send(server.sockfd, &frame, frame_wire_size(frame), MSG_NOSIGNAL) != (ssize_t)frame_wire_size(frame)) {
+        server.send_failed = true;
+        server.peer_closed = errno == EPIPE || errno == ECONNRESET;
+    }
+}
+
+// Checks if any impairment is configured.
+bool impaired() {
+    return options.loss > 0 || options.delay > 0 || options.jitter > 0 || options.bandwidth > 0 || options.ber > 0;
+}
+
+// Gets a frame.
+// Flips each of its bits with probability `options.ber`, except for the bits
+// of payload_length, so that receivers can still find where the frame ends.
+// Returns true if any bit was flipped.
+bool inject_bit_errors(Frame& frame) {
+    size_t bits = frame_wire_size(frame) * 8;
+    size_t length_begin = offsetof(FrameHeader, payload_length) * 8;
+    size_t length_end = length_begin + sizeof(frame.header.payload_length) * 8;
+    // Jump from one flipped bit to the next with geometrically distributed gaps.
+    geometric_distribution<size_t> gap(options.ber);
+    bool flipped = false;
+    for (size_t bit = gap(impair_rng); bit < bits; bit += 1 + gap(impair_rng)) {
+        if (bit >= length_begin && bit < length_end) continue;
+        ((uint8_t*)&frame)[bit / 8] ^= 1 << (bit % 8);
+        flipped = true;
+    }
+    return flipped;
+}
+
+// Gets a server and a frame for it.
+// Sends the frame through the impairment stage: it may be lost or corrupted,
+// and is delayed by the link's propagation delay, jitter and bandwidth.
+void transmit(ServerInfo& server, const Frame& frame) {
+    if (!impaired()) {
+        send_frame(server, frame);
+        return;
+    }
+    if (options.loss > 0 && uniform_real_distribution<double>(0, 1)(impair_rng) < options.loss) {
+        server.lost++;
+        return;
+    }
+    Delivery delivery{(size_t)(&server - &servers[0]), frame};
+    if (options.ber > 0 && inject_bit_errors(delivery.frame)) server.corrupted++;
+
+    // The frame waits for the link to be free, is serialized at its bandwidth, then propagates.
+    double now = now_ms();
+    double start = max(now, server.link_free_at);
+    double tx_time = options.bandwidth > 0 ? (double)frame_wire_size(frame) / options.bandwidth * options.slot_time : 0;
+    server.link_free_at = start + tx_time;
+    double due = server.link_free_at + options.delay;
+    if (options.jitter > 0) due += uniform_int_distribution<int>(0, options.jitter)(impair_rng);
+    if (due <= now) {
+        send_frame(server, delivery.frame);
+        return;
+    }
+    wheel_schedule(deliveries, (uint64_t)due, delivery);
+}
+
+// Sends the delayed deliveries that are due.
+void run_due_deliveries() {
+    if (deliveries.count == 0) return;
+    vector<Delivery> due;
+    wheel_expire(deliveries, (uint64_t)now_ms(), due);
+    for (auto& delivery : due) {
+        ServerInfo& server = servers[delivery.to];
+        if (server.is_dead) continue;
+        send_frame(server, delivery.frame);
+    }
+}
+
+// Statistics about one sub-channel.
+struct SubchannelInfo {
+    int successes = 0;          // slots in which a frame got through
+    int collisions = 0;         // slots in which frames collided
+    int deferrals = 0;          // slots held by a burst whose owner sent nothing, in which other frames deferred
+    int txops = 0;              // times a sender acquired the sub-channel for a burst
+    // The burst in progress (burst mode only).
+    int txop_owner = -1;        // index of the server holding the sub-channel, or -1
+    int txop_frames_left = 0;   // frames the owner may still send
+    int64_t txop_bytes_left = 0;    // payload bytes the owner may still start frames within (burst_bytes only)
+    double txop_expires_ms = 0; // the owner loses the sub-channel if it sends nothing until then
+    int slot_frames = 0;        // frames that arrived in the slot being resolved
+    // Tree splitting only.
+    uint32_t cri_depth = 0;     // groups of senders still to transmit in the current collision resolution interval
+    uint8_t last_outcome = SLOT_IDLE;   // outcome of the previous slot
+    int cris = 0;               // collision resolution intervals started
+    int cri_slots = 0;          // slots spent in them
+};
+
+// All the sub-channels of this channel.
+vector<SubchannelInfo> subchannel_stats;
+
+// Load on the channel between the first and the last frame it received.
+struct LoadInfo {
+    double first_ms = -1;       // wake time of the first frame received
+    double last_ms = 0;         // wake time of the last frame received
+    uint64_t frames = 0;        // frames received (transmission attempts)
+};
+
+LoadInfo load;
+
+// Longest command line an admin client may send.
+#define ADMIN_MAX_LINE 4096
+
+// Most trace output kept for an admin client that does not read it; more is dropped.
+#define ADMIN_MAX_OUTPUT (1 << 20)
+
+// A connection to the admin socket.
+struct AdminClient {
+    int fd;
+    string in;                  // received text, not a full command line yet
+    string out;                 // answers and trace lines not sent yet
+    bool tracing = false;       // the client asked for a line per resolved slot
+    bool closed = false;
+};
+
+// Shared-memory stats segment, and the row of this channel's totals in it, if any.
+StatsSegment* stats_segment = nullptr;
+StatSlot* channel_stat = nullptr;
+
+// Listening admin socket, or -1 for none.
+int admin_listener = -1;
+
+// Clients connected to the admin socket.
+vector<AdminClient> admins;
+
+// Gets a server.
+// Returns its address as "ip:port".
+string server_name(const ServerInfo& server) {
+    char ip_str[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &server.addr.sin_addr, ip_str, sizeof(ip_str));
+    return string(ip_str) + ":" + to_string(ntohs(server.addr.sin_port));
+}
+
+// Checks if any admin client asked for tracing.
+bool tracing() {
+    for (auto& client : admins) {
+        if (client.tracing) return true;
+    }
+    return false;
+}
+
+// Gets a trace line.
+// Queues it to every admin client that asked for tracing.
+void trace(const string& line) {
+    for (auto& client : admins) {
+        if (client.tracing && client.out.size() < ADMIN_MAX_OUTPUT) client.out += line + "\n";
+    }
+}
+
+// Gets the time passed since the previous call, in slots.
+// Adds every alive server's share of tokens for that time to its bucket.
+void refill_buckets(int slot_time) {
+    static double last = now_ms();
+    double now = now_ms();
+    double slots = (now - last) / slot_time;
+    last = now;
+    int alive = 0;
+    for (auto& server : servers) {
+        if (!server.is_dead) alive++;
+    }
+    if (alive == 0) return;
+    double rate = options.bucket_rate > 0 ? options.bucket_rate : 1.0 / alive;
+    for (auto& server : servers) {
+        if (server.is_dead) continue;
+        server.tokens = min(options.bucket_size, server.tokens + rate * slots);
+    }
+}
+
+// Gets the servers that transmitted in the same slot.
+// Returns the one with the most tokens if it is strictly ahead of all the
+// others, or nullptr if there is no single most starved server.
+ServerInfo* pick_starved(const vector<ServerInfo*>& ready) {
+    ServerInfo* best = nullptr;
+    bool tie = false;
+    for (auto server : ready) {
+        if (!best || server->tokens > best->tokens) {
+            best = server;
+            tie = false;
+        } else if (server->tokens == best->tokens) {
+            tie = true;
+        }
+    }
+    return tie ? nullptr : best;
+}
+
+// Gets the servers that transmitted in the same slot.
+// Picks the one whose frame should get through despite the collision,
+// according to the priority and fairness modes.
+// Returns nullptr if the slot is a plain collision.
+ServerInfo* arbitrate(const vector<ServerInfo*>& ready) {
+    vector<ServerInfo*> candidates = ready;
+    if (options.priority == PRIORITY_STRICT) {
+        // Only the frames of the highest class present compete.
+        uint8_t top = 0;
+        for (auto server : ready) top = max(top, server->frame.header.traffic_class);
+        candidates.clear();
+        for (auto server : ready) {
+            if (server->frame.header.traffic_class == top) candidates.push_back(server);
+        }
+    } else if (options.priority == PRIORITY_WEIGHTED) {
+        // If classes are mixed, draw a winning class by the class weights.
+        int total = 0, present = 0;
+        bool seen[NUM_CLASSES] = {};
+        for (auto server : ready) seen[server->frame.header.traffic_class] = true;
+        for (int c = 0; c < NUM_CLASSES; c++) {
+            if (!seen[c]) continue;
+            total += class_weights[c];
+            present++;
+        }
+        if (present > 1) {
+            int draw = uniform_int_distribution<int>(0, total - 1)(rng);
+            int chosen = 0;
+            for (; chosen < NUM_CLASSES; chosen++) {
+                if (!seen[chosen]) continue;
+                if (draw < class_weights[chosen]) break;
+                draw -= class_weights[chosen];
+            }
+            candidates.clear();
+            for (auto server : ready) {
+                if (server->frame.header.traffic_class == chosen) candidates.push_back(server);
+            }
+        }
+    }
+    if (candidates.size() == 1) return candidates[0];
+    return options.fair ? pick_starved(candidates) : nullptr;
+}
+
+// Gets the delivered sequence numbers of a source and a sequence number.
+// Checks if that sequence number was delivered already; numbers older than
+// the window are taken as new.
+bool seq_seen(const SeqWindow& window, uint32_t seq) {
+    if (!window.any || seq > window.highest) return false;
+    uint32_t back = window.highest - seq;
+    return back == 0 || (back <= 64 && ((window.below >> (back - 1)) & 1));
+}
+
+// Gets the delivered sequence numbers of a source.
+// Adds `seq` to them, sliding the window when it is the new highest.
+void seq_mark(SeqWindow& window, uint32_t seq) {
+    if (!window.any) {
+        window.any = true;
+        window.highest = seq;
+        return;
+    }
+    if (seq > window.highest) {
+        uint32_t shift = seq - window.highest;
+        if (shift > 64) window.below = 0;
+        else if (shift == 64) window.below = 1ULL << 63;
+        else window.below = (window.below << shift) | (1ULL << (shift - 1));
+        window.highest = seq;
+    } else if (seq < window.highest && window.highest - seq <= 64) {
+        window.below |= 1ULL << (window.highest - seq - 1);
+    }
+}
+
+// Gets a server that transmitted a frame successfully.
+// Checks if the frame was delivered already (its ACK got lost or was late),
+// and if so sends a re-ACK, the frame's header alone, to the sender instead
+// of broadcasting it again.
+// Returns true if the frame was a duplicate.
+bool reack_duplicate(ServerInfo& sender) {
+    SeqWindow& window = sender.delivered[id_to_key(sender.frame.header.source_id)];
+    uint32_t seq = sender.frame.header.seq_number;
+    if (!seq_seen(window, seq)) {
+        seq_mark(window, seq);
+        return false;
+    }
+    size_t receivers = 0;
+    for (auto& server : servers) {
+        if (!server.is_dead) receivers++;
+    }
+    dedup_bytes_saved += receivers * frame_wire_size(sender.frame) - sizeof(FrameHeader);
+    sender.duplicates++;
+    Frame reack = sender.frame;
+    create_reack_frame(reack);
+    transmit(sender, reack);
+    return true;
+}
+
+// Gets a sub-channel.
+// Checks if a burst holds it right now.
+bool txop_active(const SubchannelInfo& info) {
+    return info.txop_owner >= 0 && now_ms() <= info.txop_expires_ms;
+}
+
+// Gets a server whose frame got through on its sub-channel (burst mode only).
+// Starts a burst (TXOP) for it if it just acquired the sub-channel, or charges
+// the frame to its burst; the burst ends once it used its frames or bytes.
+// The owner must send its next frame within two slots to keep the sub-channel.
+void charge_txop(ServerInfo& sender) {
+    SubchannelInfo& info = subchannel_stats[sender.frame.header.subchannel];
+    int index = &sender - &servers[0];
+    if (txop_active(info) && info.txop_owner == index) {
+        sender.burst_frames++;
+        info.txop_frames_left--;
+    } else {
+        info.txops++;
+        info.txop_owner = index;
+        info.txop_frames_left = options.burst - 1;
+        info.txop_bytes_left = options.burst_bytes;
+    }
+    info.txop_bytes_left -= sender.frame.header.payload_length;
+    info.txop_expires_ms = now_ms() + 2 * options.slot_time;
+    if (info.txop_frames_left <= 0 || (options.burst_bytes > 0 && info.txop_bytes_left <= 0)) info.txop_owner = -1;
+}
+
+// Gets a server that transmitted a frame successfully.
+// Sends the frame to all connected (and alive) servers, and charges its sender.
+// With duplicate suppression, a frame delivered before is only re-ACKed to its sender.
+void deliver_frame(ServerInfo& sender) {
+    if (options.burst > 1) charge_txop(sender);
+    // Repair frames (FEC) reuse the sequence number of their block's first frame.
+    if (options.dedup && !is_repair_frame(sender.frame) && reack_duplicate(sender)) {
+        sender.tokens -= 1;
+        return;
+    }
+    for (auto& server : servers) {
+        if (server.is_dead) continue;
+#ifdef DEBUG
+        static int num_acks;
+        num_acks++;
+        cout << "Going to send ACK no. " << num_acks << endl;
+#endif
+        transmit(server, sender.frame);
+    }
+    sender.frames++;
+    sender.class_frames[sender.frame.header.traffic_class]++;
+    sender.bytes += sender.frame.header.payload_length;
+    sender.tokens -= 1;
+}
+
+// Gets a frame and the index of a server.
+// Queues the frame for sending to that server, unless its egress queue is full.
+void enqueue_egress(const Frame& frame, size_t to) {
+    ServerInfo& server = servers[to];
+    if (server.egress.size() >= options.queue_size) {
+        server.egress_drops++;
+        return;
+    }
+    server.egress.push_back(frame);
+    server.max_egress = max(server.max_egress, server.egress.size());
+}
+
+// Runs one slot of the switch: every port switches the head of its ingress
+// queue (learning its source and ACKing it to the sender), then every port
+// sends the head of its egress queue.
+void switch_slot() {
+    for (size_t from = 0; from < servers.size(); from++) {
+        ServerInfo& sender = servers[from];
+        if (sender.is_dead || sender.ingress.empty()) continue;
+        Frame frame = sender.ingress.front();
+        sender.ingress.pop_front();
+        mac_table[id_to_key(frame.header.source_id)] = from;
+
+        // Forward by destination, or flood it when the destination is unknown.
+        auto known = mac_table.find(id_to_key(frame.header.dest_id));
+        if (known != mac_table.end()) {
+            if (known->second != from && !servers[known->second].is_dead) enqueue_egress(frame, known->second);
+        } else {
+            for (size_t to = 0; to < servers.size(); to++) {
+                if (to != from && !servers[to].is_dead) enqueue_egress(frame, to);
+            }
+        }
+
+        // ACK the frame to its sender.
+        transmit(sender, frame);
+        sender.frames++;
+        sender.bytes += frame.header.payload_length;
+        sender.class_frames[frame.header.traffic_class]++;
+    }
+    for (auto& server : servers) {
+        if (server.is_dead || server.egress.empty()) continue;
+        Frame& frame = server.egress.front();
+        transmit(server, frame);
+        server.egress.pop_front();
+    }
+}
+
+// Gets the slot time.
+// Runs the switch slots that are due since the previous call.
+void run_switch_slots(int slot_time) {
+    static double next_slot = now_ms();
+    double now = now_ms();
+    for (int i = 0; next_slot <= now && i < 1000; i++) {
+        switch_slot();
+        next_slot += slot_time;
+    }
+    if (next_slot <= now) next_slot = now;
+}
+
+// Gets the servers that transmitted on a sub-channel held by a burst.
+// Delivers the owner's frame, if it sent one, and tells the others to defer
+// until the burst is over, so that it is not broken by collisions. Deferring
+// is not a collision: the others wait without counting it as an attempt.
+void resolve_txop_slot(const vector<ServerInfo*>& ready, uint8_t subchannel) {
+    SubchannelInfo& info = subchannel_stats[subchannel];
+    ServerInfo& holder = servers[info.txop_owner];
+    ServerInfo* owner = nullptr;
+    for (auto server : ready) {
+        if (server == &holder) owner = server;
+    }
+    if (owner) {
+        deliver_frame(*owner);
+        info.successes++;
+    } else {
+        info.deferrals++;
+    }
+    // The owner's delivery may have ended the burst; then the others may go on in the next slot.
+    Frame defer;
+    create_defer_frame(defer, subchannel, txop_active(info) ? max(info.txop_frames_left, 1) : 1);
+    for (auto server : ready) {
+        if (server == owner || server->is_dead) continue;
+        server->deferred++;
+        server->backing_off = true;
+        transmit(*server, defer);
+    }
+    if (tracing()) {
+        ostringstream line;
+        line << fixed << setprecision(3) << now_ms() << " ms, sub-channel " << (int)subchannel << ": burst of "
+             << server_name(holder) << ", " << ready.size() - (owner ? 1 : 0) << " frames deferred";
+        trace(line.str());
+    }
+}
+
+// Gets the servers that transmitted on the same sub-channel in the same slot.
+// Delivers the frame if there is no collision (or one sender wins the
+// arbitration), and sends noise for that sub-channel otherwise.
+void resolve_slot(const vector<ServerInfo*>& ready, uint8_t subchannel) {
+    // While a burst holds the sub-channel, only its owner gets through; the others defer.
+    if (txop_active(subchannel_stats[subchannel])) {
+        resolve_txop_slot(ready, subchannel);
+        return;
+    }
+    // If exactly one frame was received, there is no collision.
+    if (ready.size() == 1) {
+        // Resend frame to all connected (and alive) servers.
+        deliver_frame(*ready[0]);
+        subchannel_stats[subchannel].successes++;
+        if (tracing()) {
+            ostringstream line;
+            line << fixed << setprecision(3) << now_ms() << " ms, sub-channel " << (int)subchannel
+                 << ": delivered from " << server_name(*ready[0]);
+            trace(line.str());
+        }
+        return;
+    }
+    // If more than one frame was received, there is a collision.
+    // Increment collision count on all servers that participated in the collision.
+    for (auto& server : ready) {
+        if (server->is_dead) continue;
+        server->collisions++;
+        server->backing_off = true;
+    }
+    subchannel_stats[subchannel].collisions++;
+    Frame noise;
+    create_noise_frame(noise);
+    noise.header.subchannel = subchannel;
+    // In priority or fair mode, one sender may still win; only the others get noise.
+    ServerInfo* winner = arbitrate(ready);
+    if (tracing()) {
+        ostringstream line;
+        line << fixed << setprecision(3) << now_ms() << " ms, sub-channel " << (int)subchannel << ": collision of "
+             << ready.size() << " frames";
+        if (winner) line << ", won by " << server_name(*winner);
+        trace(line.str());
+    }
+    if (winner) {
+        winner->arbitrations_won++;
+        winner->backing_off = false;
+        deliver_frame(*winner);
+        for (auto& server : ready) {
+            if (server == winner || server->is_dead) continue;
+            transmit(*server, noise);
+        }
+    } else {
+        // Send a noise frame to everyone.
+        for (auto& server : servers) {
+            if (server.is_dead) continue;
+            transmit(server, noise);
+        }
+    }
+}
+
 // Gets a port number.
 // Creates a listening socket to listen for incoming connections in that port.
 // Returns the socket.
@@ -45,13 +717,836 @@ int setup_server(int port) {
     return listener;
 }
 
-// Gets the arguments to the program (argv), already converted to ints.
-// Runs a channel.
+// Gets the address and socket of a newly connected server (-1 when replayed).
+// Adds it to the list of servers.
+void add_server(const sockaddr_in& addr, int sockfd) {
+    ServerInfo server;
+    server.addr = addr;
+    server.sockfd = sockfd;
+    server.last_heard_ms = now_ms();
+    server.stat = claim_stat_slot(stats_segment, STAT_PORT, server_name(server));
+    servers.push_back(server);
+    record_event(EVENT_CONNECT, servers.size() - 1, nullptr);
+}
+
+// Publishes the statistics of the channel and of every connection to the
+// shared-memory stats, and gives back the rows of closed connections.
+void publish_shm_stats() {
+    if (!stats_segment) return;
+    StatValues totals;
+    for (auto& info : subchannel_stats) {
+        totals.frames += info.successes;
+        totals.collisions += info.collisions;
+    }
+    totals.transmissions = load.frames;
+    for (auto& server : servers) {
+        totals.bytes += server.bytes;
+        if (!server.stat) continue;
+        if (server.is_dead) {
+            release_stat_slot(server.stat);
+            server.stat = nullptr;
+            continue;
+        }
+        StatValues values;
+        values.frames = server.frames;
+        values.bytes = server.bytes;
+        values.collisions = server.collisions;
+        values.drops = server.ingress_drops + server.egress_drops + server.lost;
+        publish_stats(server.stat, values);
+    }
+    publish_stats(channel_stat, totals);
+}
+
+// Gets the servers whose frames arrived in the same wake, and the slot time.
+// Queues them in switch mode, or resolves the slot of every sub-channel.
+void handle_arrivals(vector<ServerInfo*>& ready, int slot_time) {
+    if (!ready.empty()) {
+        if (load.first_ms < 0) load.first_ms = now_ms();
+        load.last_ms = now_ms();
+        load.frames += ready.size();
+    }
+    for (auto server : ready) {
+        server->backing_off = false;
+        if (server->frame.header.traffic_class >= NUM_CLASSES) server->frame.header.traffic_class = CLASS_BULK;
+        server->frame.header.subchannel %= options.subchannels;
+    }
+
+    // In switch mode, frames wait in their port's queue instead of colliding.
+    if (options.switched) {
+        for (auto server : ready) {
+            if (server->ingress.size() >= options.queue_size) {
+                server->ingress_drops++;
+                continue;
+            }
+            server->ingress.push_back(server->frame);
+        }
+        run_switch_slots(slot_time);
+        return;
+    }
+
+    if (!ready.empty()) refill_buckets(slot_time);
+
+    // Each sub-channel is its own collision domain.
+    for (int subchannel = 0; subchannel < options.subchannels; subchannel++) {
+        vector<ServerInfo*> on_subchannel;
+        for (auto server : ready) {
+            if (server->frame.header.subchannel == subchannel) on_subchannel.push_back(server);
+        }
+        subchannel_stats[subchannel].slot_frames = on_subchannel.size();
+        if (!on_subchannel.empty()) resolve_slot(on_subchannel, subchannel);
+    }
+}
+
+// Slotted mode: the servers (indices in `servers`) whose frames arrived in the current slot.
+vector<size_t> slot_senders;
+
+// Gets the servers whose frames arrived in the same wake, and the slot time.
+// Handles them right away, or in slotted mode when their slot ends.
+void frames_arrived(vector<ServerInfo*>& ready, int slot_time) {
+    if (!options.slotted) {
+        handle_arrivals(ready, slot_time);
+        return;
+    }
+    for (auto server : ready) {
+        size_t index = server - &servers[0];
+        if (find(slot_senders.begin(), slot_senders.end(), index) == slot_senders.end()) slot_senders.push_back(index);
+    }
+}
+
+// Resolves the frames that arrived during the current slot as a single slot.
+void flush_slot() {
+    vector<ServerInfo*> ready;
+    for (size_t index : slot_senders) ready.push_back(&servers[index]);
+    slot_senders.clear();
+    handle_arrivals(ready, options.slot_time);
+}
+
+// Tree splitting: broadcasts the outcome of the slot that just ended on every
+// sub-channel (idle, success or collision), and follows its collision
+// resolution interval. Every collision splits the group that transmitted in
+// two; every idle or successful slot resolves one group. The interval ends
+// once no group is left, and everyone with a frame joins the next one.
+// An idle slot right after a collision means the other half of the group
+// would surely collide, so it splits without transmitting (Massey's
+// improvement of the Capetanakis tree). That is only assumed once: the
+// group may be empty after all (its senders gave up, or did not follow the
+// tree), so an idle slot after a split resolves a group as usual, and the
+// interval always ends.
+void send_tree_feedback() {
+    for (int subchannel = 0; subchannel < options.subchannels; subchannel++) {
+        SubchannelInfo& info = subchannel_stats[subchannel];
+        SlotFeedback feedback{};
+        feedback.outcome = info.slot_frames == 0 ? SLOT_IDLE : info.slot_frames == 1 ? SLOT_SUCCESS : SLOT_COLLISION;
+        info.slot_frames = 0;
+        feedback.split = info.cri_depth > 0 && feedback.outcome == SLOT_IDLE && info.last_outcome == SLOT_COLLISION;
+        info.last_outcome = feedback.outcome;
+        if (info.cri_depth > 0 || feedback.outcome != SLOT_IDLE) {
+            if (info.cri_depth == 0) {
+                info.cris++;
+                info.cri_depth = 1;
+            }
+            info.cri_slots++;
+            // A split resolves the idle group and splits the next one, which leaves as many groups.
+            if (feedback.outcome == SLOT_COLLISION) info.cri_depth++;
+            else if (!feedback.split) info.cri_depth--;
+            if (info.cri_depth == 0 && tracing()) {
+                ostringstream line;
+                line << fixed << setprecision(3) << now_ms() << " ms, sub-channel " << subchannel
+                     << ": collision resolution interval over";
+                trace(line.str());
+            }
+        }
+        feedback.depth = info.cri_depth;
+        Frame frame;
+        create_feedback_frame(frame, subchannel, feedback);
+        // Feedback goes over an ideal control link: the impairments never lose, corrupt or delay it.
+        for (auto& server : servers) {
+            if (!server.is_dead) send_frame(server, frame);
+        }
+    }
+}
+
+// Gets the slot time.
+// In slotted mode, if the current slot is over, resolves the frames that
+// arrived during it (and announces its outcome in tree splitting mode).
+// Returns true if a slot ended.
+bool end_slot_if_due(int slot_time) {
+    // Slots start at multiples of the slot time since the channel started.
+    static double slot_end = slot_time;
+    if (!options.slotted || now_ms() < slot_end) return false;
+    slot_end += slot_time * (floor((now_ms() - slot_end) / slot_time) + 1);
+    flush_slot();
+    if (options.tree) send_tree_feedback();
+    return true;
+}
+
+// Time series of the channel's load, if sampling.
+Sampler sampler;
+
+// Takes a sample of the channel's load if one is due.
+void sample_channel() {
+    if (!sample_due(sampler, (uint64_t)now_ms())) return;
+    SampleCounters counters;
+    for (auto& info : subchannel_stats) counters.collisions += info.collisions;
+    counters.transmissions = load.frames;
+    counters.in_flight = slot_senders.size() + deliveries.count;
+    for (auto& server : servers) {
+        counters.frames += server.frames;
+        counters.bytes += server.bytes;
+        if (server.is_dead) continue;
+        counters.in_flight += server.ingress.size() + server.egress.size();
+        if (server.backing_off) counters.backing_off++;
+        counters.active++;
+    }
+    take_sample(sampler, (uint64_t)now_ms(), counters);
+}
+
+// Gets the number of frames each server delivered.
+// Returns Jain's fairness index of those numbers: 1 when all are equal,
+// down to 1/n when a single server got everything.
+double jain_index() {
+    double sum = 0, sum_squares = 0;
+    for (auto& server : servers) {
+        sum += server.frames;
+        sum_squares += (double)server.frames * server.frames;
+    }
+    if (sum_squares == 0) return 1;
+    return sum * sum / (servers.size() * sum_squares);
+}
+
+// Gets a stream.
+// Writes statistics about received frames and collisions to it.
+void print_stats(ostream& out) {
+    for (auto& server : servers) {
+        char ip_str[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &server.addr.sin_addr, ip_str, sizeof(ip_str));
+        out << "From " << ip_str << " port " << ntohs(server.addr.sin_port)
+            << ": " << server.frames << " frames, " << server.bytes << " bytes, "
+            << server.collisions << " collisions";
+        if (options.fair || options.priority != PRIORITY_NONE) {
+            out << ", " << server.arbitrations_won << " arbitrations won";
+        }
+        if (options.switched) {
+            out << ", " << server.ingress_drops << " ingress drops, " << server.egress_drops
+                 << " egress drops, max egress queue " << server.max_egress;
+        }
+        if (impaired()) {
+            out << ", " << server.lost << " lost, " << server.corrupted << " corrupted";
+        }
+        if (options.dedup) out << ", " << server.duplicates << " duplicates";
+        if (options.burst > 1) out << ", " << server.burst_frames << " burst frames, " << server.deferred << " deferred";
+        if (server.class_frames[CLASS_CONTROL] > 0) {
+            out << " (" << server.class_frames[CLASS_CONTROL] << " control frames)";
+        }
+        out << endl;
+    }
+    out << "Jain's fairness index: " << jain_index() << endl;
+    if (load.frames > 0 && !options.switched) {
+        // Count slots (of every sub-channel) over the busy period; those with neither a success nor a collision were idle.
+        int successes = 0, collisions = 0, deferrals = 0;
+        for (auto& info : subchannel_stats) {
+            successes += info.successes;
+            collisions += info.collisions;
+            deferrals += info.deferrals;
+        }
+        uint64_t slots = ((uint64_t)((load.last_ms - load.first_ms) / options.slot_time) + 1) * options.subchannels;
+        uint64_t busy = successes + collisions + deferrals;
+        out << "Slots: " << slots << " elapsed, " << successes << " successful, " << collisions << " collision, ";
+        if (options.burst > 1) out << deferrals << " deferred, ";
+        out << (slots > busy ? slots - busy : 0) << " idle, " << load.frames << " frames received" << endl;
+    }
+    if (health.errors + health.malformed + health.idle > 0) {
+        out << "Connections: " << health.closed << " closed, " << health.errors << " evicted on errors, "
+            << health.malformed << " evicted for malformed frames, " << health.idle << " evicted when idle" << endl;
+    }
+    if (options.dedup) {
+        int duplicates = 0;
+        for (auto& server : servers) duplicates += server.duplicates;
+        out << "Duplicates: " << duplicates << " re-ACKed, " << dedup_bytes_saved << " broadcast bytes saved" << endl;
+    }
+    if (options.burst > 1) {
+        int txops = 0, burst_frames = 0, deferred = 0;
+        for (auto& info : subchannel_stats) txops += info.txops;
+        for (auto& server : servers) {
+            burst_frames += server.burst_frames;
+            deferred += server.deferred;
+        }
+        out << "Bursts: " << txops << " TXOPs, " << burst_frames << " frames sent in bursts, " << deferred
+            << " frames deferred" << endl;
+    }
+    if (options.tree) {
+        int cris = 0, cri_slots = 0;
+        for (auto& info : subchannel_stats) {
+            cris += info.cris;
+            cri_slots += info.cri_slots;
+        }
+        out << "Tree splitting: " << cris << " collision resolution intervals, " << cri_slots << " slots ("
+            << (double)cri_slots / max(cris, 1) << " per interval)" << endl;
+    }
+    if (options.switched) out << "Learned " << mac_table.size() << " source IDs" << endl;
+    if (options.subchannels > 1) {
+        for (int subchannel = 0; subchannel < options.subchannels; subchannel++) {
+            out << "Sub-channel " << subchannel << ": " << subchannel_stats[subchannel].successes << " successful slots, "
+                 << subchannel_stats[subchannel].collisions << " collision slots" << endl;
+        }
+    }
+}
+
+// Gets the port the channel listened on (0 when replaying).
+// Writes the final report as a single JSON object: the options of the
+// channel, then the same counters as print_stats, with nothing left out
+// for brevity.
+void print_stats_json(ostream& out, int port) {
+    const char* priority_names[] = {"none", "strict", "weighted"};
+    JsonWriter json{out, {}};
+    json_begin_object(json);
+    json_value(json, "program", "channel");
+    json_begin_object(json, "options");
+    json_value(json, "port", port);
+    json_value(json, "slot_time_ms", options.slot_time);
+    json_value(json, "seed", options.seed);
+    json_value(json, "fair", options.fair);
+    json_value(json, "priority", priority_names[options.priority]);
+    json_value(json, "switched", options.switched);
+    json_value(json, "slotted", options.slotted);
+    json_value(json, "queue_size", options.queue_size);
+    json_value(json, "subchannels", options.subchannels);
+    json_value(json, "loss", options.loss);
+    json_value(json, "delay_ms", options.delay);
+    json_value(json, "jitter_ms", options.jitter);
+    json_value(json, "bandwidth", options.bandwidth);
+    json_value(json, "ber", options.ber);
+    json_value(json, "bucket_rate", options.bucket_rate);
+    json_value(json, "bucket_size", options.bucket_size);
+    json_value(json, "replay", options.replay);
+    json_value(json, "idle_timeout_ms", options.idle_timeout);
+    json_value(json, "keepalive_s", options.keepalive);
+    json_value(json, "dedup", options.dedup);
+    json_value(json, "burst", options.burst);
+    json_value(json, "tree", options.tree);
+    json_value(json, "burst_bytes", options.burst_bytes);
+    json_end_object(json);
+
+    json_begin_array(json, "servers");
+    for (auto& server : servers) {
+        char ip_str[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &server.addr.sin_addr, ip_str, sizeof(ip_str));
+        json_begin_object(json);
+        json_value(json, "address", ip_str);
+        json_value(json, "port", ntohs(server.addr.sin_port));
+        json_value(json, "connected", !server.is_dead);
+        json_value(json, "frames", server.frames);
+        json_value(json, "bytes", server.bytes);
+        json_value(json, "collisions", server.collisions);
+        json_value(json, "arbitrations_won", server.arbitrations_won);
+        json_value(json, "control_frames", server.class_frames[CLASS_CONTROL]);
+        json_value(json, "ingress_drops", server.ingress_drops);
+        json_value(json, "egress_drops", server.egress_drops);
+        json_value(json, "max_egress", server.max_egress);
+        json_value(json, "lost", server.lost);
+        json_value(json, "corrupted", server.corrupted);
+        json_value(json, "duplicates", server.duplicates);
+        json_value(json, "burst_frames", server.burst_frames);
+        json_value(json, "deferred", server.deferred);
+        json_end_object(json);
+    }
+    json_end_array(json);
+
+    int successes = 0, collisions = 0, deferrals = 0;
+    json_begin_array(json, "subchannels");
+    for (auto& info : subchannel_stats) {
+        successes += info.successes;
+        collisions += info.collisions;
+        deferrals += info.deferrals;
+        json_begin_object(json);
+        json_value(json, "successful_slots", info.successes);
+        json_value(json, "collision_slots", info.collisions);
+        json_value(json, "deferred_slots", info.deferrals);
+        json_value(json, "txops", info.txops);
+        json_value(json, "collision_resolution_intervals", info.cris);
+        json_value(json, "collision_resolution_slots", info.cri_slots);
+        json_end_object(json);
+    }
+    json_end_array(json);
+
+    // Same slot counts as the "Slots:" line; all zero when no frame was received.
+    uint64_t slots = load.frames > 0 ? ((uint64_t)((load.last_ms - load.first_ms) / options.slot_time) + 1) * options.subchannels : 0;
+    uint64_t busy = successes + collisions + deferrals;
+    json_begin_object(json, "slots");
+    json_value(json, "elapsed", slots);
+    json_value(json, "successful", successes);
+    json_value(json, "collision", collisions);
+    json_value(json, "deferred", deferrals);
+    json_value(json, "idle", slots > busy ? slots - busy : 0);
+    json_value(json, "frames_received", load.frames);
+    json_value(json, "first_frame_ms", load.first_ms);
+    json_value(json, "last_frame_ms", load.last_ms);
+    json_end_object(json);
+    json_begin_object(json, "connections");
+    json_value(json, "closed", health.closed);
+    json_value(json, "evicted_errors", health.errors);
+    json_value(json, "evicted_malformed", health.malformed);
+    json_value(json, "evicted_idle", health.idle);
+    json_value(json, "partial_reads", health.partial_reads);
+    json_value(json, "spurious_wakeups", health.spurious_wakeups);
+    json_end_object(json);
+    json_value(json, "dedup_bytes_saved", dedup_bytes_saved);
+    json_value(json, "jain_index", jain_index());
+    json_value(json, "learned_source_ids", mac_table.size());
+    json_value(json, "elapsed_ms", now_ms());
+    json_end_object(json);
+}
+
+// Gets the port the channel listened on.
+// Writes the final JSON report to `options.json`, if set.
+void write_json_report(int port) {
+    if (!options.json) return;
+    if (string(options.json) == "-") {
+        print_stats_json(cout, port);
+        cout.flush();
+        return;
+    }
+    ofstream file(options.json);
+    if (!file) {
+        cerr << "Error: Cannot create JSON report " << options.json << endl;
+        return;
+    }
+    print_stats_json(file, port);
+}
+
+// File the reports are appended to, if `options.stats_log` is set.
+ofstream stats_log;
+
+// (Re)opens the stats log, e.g. after it was rotated.
+// Returns true on success, or false otherwise.
+bool open_stats_log() {
+    if (stats_log.is_open()) stats_log.close();
+    stats_log.open(options.stats_log, ios::app);
+    return stats_log.is_open();
+}
+
+// Display statistics about received frames and collisions, on stderr or in the stats log.
+void report_stats() {
+    ostream& out = stats_log.is_open() ? (ostream&)stats_log : cerr;
+    print_stats(out);
+    out.flush();
+#ifdef DEBUG
+    cout << "end of report" << endl;
+#endif
+}
+
+// Resets the statistics of every server and sub-channel.
+void reset_stats() {
+    for (auto& server : servers) {
+        server.frames = 0;
+        server.collisions = 0;
+        server.bytes = 0;
+        server.arbitrations_won = 0;
+        for (auto& count : server.class_frames) count = 0;
+        server.ingress_drops = 0;
+        server.egress_drops = 0;
+        server.max_egress = 0;
+        server.lost = 0;
+        server.corrupted = 0;
+        server.duplicates = 0;
+        server.burst_frames = 0;
+        server.deferred = 0;
+    }
+    for (auto& info : subchannel_stats) {
+        // Senders keep following the collision resolution interval in progress.
+        uint32_t cri_depth = info.cri_depth;
+        info = SubchannelInfo();
+        info.cri_depth = cri_depth;
+    }
+    load = LoadInfo();
+    dedup_bytes_saved = 0;
+}
+
+// Gets a server.
+// Disconnects it from the channel.
+void kick_server(ServerInfo& server) {
+    if (server.sockfd >= 0) close(server.sockfd);
+    server.is_dead = true;
+}
+
+// Gets why a server's connection ended (CLOSE_*).
+// Counts it.
+void count_close(uint32_t reason) {
+    if (reason == CLOSE_ERROR) health.errors++;
+    else if (reason == CLOSE_MALFORMED) health.malformed++;
+    else if (reason == CLOSE_IDLE) health.idle++;
+    else health.closed++;
+}
+
+// Gets a server whose connection ended or misbehaved, and the reason (CLOSE_*).
+// Closes the connection, so the server no longer counts as a transmitter.
+void evict_server(ServerInfo& server, uint32_t reason) {
+    const char* reason_names[] = {"closed", "evicted on an error", "evicted for a malformed frame", "evicted when idle"};
+    count_close(reason);
+    kick_server(server);
+    record_event(EVENT_CLOSE, &server - &servers[0], nullptr, reason);
+    if (tracing()) {
+        ostringstream line;
+        line << fixed << setprecision(3) << now_ms() << " ms: " << server_name(server) << " " << reason_names[reason];
+        trace(line.str());
+    }
+}
+
+// Outcome of reading from a server's socket.
+enum ReadResult {
+    READ_FRAME,         // a whole frame was received into `server.frame`
+    READ_PARTIAL,       // part of a frame was received
+    READ_NOTHING,       // the socket had nothing to read after all
+    READ_CLOSED,        // the server closed the connection
+    READ_ERROR,         // the connection broke
+    READ_MALFORMED,     // the server sent a header with an impossible payload length
+};
+
+// Gets a server whose socket is readable.
+// Reads the rest of its current frame, and no further, so the frames that
+// follow wait in the socket for later wakes.
+// Returns what was read.
+ReadResult read_frame(ServerInfo& server) {
+    bool got_bytes = false;
+    while (true) {
+        size_t want = sizeof(FrameHeader);
+        if (server.rx_len >= sizeof(FrameHeader)) {
+            if (server.rx.header.payload_length > MAX_PAYLOAD_SIZE) return READ_MALFORMED;
+            want = frame_wire_size(server.rx);
+            if (server.rx_len == want) {
+                memcpy(&server.frame, &server.rx, want);
+                server.rx_len = 0;
+                return READ_FRAME;
+            }
+        }
+        ssize_t res = recv(server.sockfd, (char*)&server.rx + server.rx_len, want - server.rx_len, 0);
+        if (res == 0) return READ_CLOSED;
+        if (res < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return got_bytes ? READ_PARTIAL : READ_NOTHING;
+            // A server that closes with frames it did not read yet resets the
+            // connection; between two frames, that is still a normal close.
+            if (errno == ECONNRESET && server.rx_len == 0) return READ_CLOSED;
+            return READ_ERROR;
+        }
+        server.rx_len += res;
+        got_bytes = true;
+    }
+}
+
+// Evicts the servers that could not take a frame, or stayed silent for
+// longer than the idle timeout.
+void evict_unhealthy_servers() {
+    for (auto& server : servers) {
+        if (server.is_dead || server.sockfd < 0) continue;
+        if (server.send_failed) {
+            // Writing to a server that already closed the connection fails too, but is no fault.
+            evict_server(server, server.peer_closed ? CLOSE_EOF : CLOSE_ERROR);
+        } else if (options.idle_timeout > 0 && now_ms() - server.last_heard_ms > options.idle_timeout) {
+            evict_server(server, CLOSE_IDLE);
+        }
+    }
+}
+
+// Gets the servers' sockets that are readable.
+// Receives a frame from each server that completed one, and evicts the
+// servers whose connection ended, broke or sent garbage.
+// Returns the servers that sent a frame.
+vector<ServerInfo*> receive_frames(const fd_set& fds) {
+    vector<ServerInfo*> ready;
+    for (auto& server : servers) {
+        if (server.is_dead || !FD_ISSET(server.sockfd, &fds)) continue;
+        switch (read_frame(server)) {
+        case READ_FRAME:
+            server.last_heard_ms = now_ms();
+            record_event(EVENT_ARRIVAL, &server - &servers[0], &server.frame);
+            ready.push_back(&server);
+            break;
+        case READ_PARTIAL:
+            server.last_heard_ms = now_ms();
+            health.partial_reads++;
+            break;
+        case READ_NOTHING:
+            health.spurious_wakeups++;
+            break;
+        case READ_CLOSED:
+            evict_server(server, CLOSE_EOF);
+            break;
+        case READ_ERROR:
+            evict_server(server, CLOSE_ERROR);
+            break;
+        case READ_MALFORMED:
+            evict_server(server, CLOSE_MALFORMED);
+            break;
+        }
+    }
+    return ready;
+}
+
+// Gets the socket of a newly connected server.
+// Enables TCP keepalive on it, so that a peer that vanished without closing
+// the connection is detected (as a receive error) within a bounded time.
+void set_keepalive(int sockfd) {
+    if (options.keepalive <= 0) return;
+    int on = 1, idle = options.keepalive, interval = max(1, options.keepalive / 5), count = 3;
+    setsockopt(sockfd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+    setsockopt(sockfd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+    setsockopt(sockfd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+    setsockopt(sockfd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+}
+
+// Returns the modes that can be changed at run time, packed for the session log.
+uint32_t mode_bits() {
+    return (options.fair ? 1 : 0) | (options.priority << 1) | (options.slotted ? 8 : 0);
+}
+
+// Gets modes packed by mode_bits().
+// Switches the channel to them. Frames waiting for the end of a slot are
+// resolved right away when slotted mode is turned off.
+void set_mode_bits(uint32_t bits) {
+    options.fair = bits & 1;
+    options.priority = (PriorityMode)((bits >> 1) & 3);
+    bool slotted = bits & 8;
+    if (options.slotted && !slotted && !slot_senders.empty()) flush_slot();
+    options.slotted = slotted;
+}
+
+// Gets an admin client and a command line it sent.
+// Runs the command and queues its answer to the client.
+void run_admin_command(AdminClient& client, const string& line) {
+    istringstream in(line);
+    string command, arg;
+    in >> command >> arg;
+    ostringstream out;
+    if (command.empty()) {
+        return;
+    } else if (command == "stats") {
+        print_stats(out);
+    } else if (command == "servers") {
+        for (size_t i = 0; i < servers.size(); i++) {
+            out << i << " " << server_name(servers[i]) << (servers[i].is_dead ? " dead" : " alive") << "\n";
+        }
+    } else if (command == "reset") {
+        reset_stats();
+        record_event(EVENT_RESET, servers.size(), nullptr);
+        out << "ok\n";
+    } else if (command == "slot-time" && !arg.empty() && all_of(arg.begin(), arg.end(), ::isdigit) &&
+               stoi(arg) > 0 && stoi(arg) < 65536) {
+        options.slot_time = stoi(arg);
+        record_event(EVENT_SLOT_TIME, servers.size(), nullptr, options.slot_time);
+        out << "ok\n";
+    } else if (command == "kick" && !arg.empty()) {
+        size_t found = servers.size();
+        for (size_t i = 0; i < servers.size(); i++) {
+            if (arg == to_string(i) || arg == server_name(servers[i])) found = i;
+        }
+        if (found == servers.size() || servers[found].is_dead) {
+            out << "error: no connected server " << arg << "\n";
+        } else {
+            kick_server(servers[found]);
+            record_event(EVENT_KICK, found, nullptr);
+            out << "ok\n";
+        }
+    } else if (command == "mode") {
+        string value;
+        in >> value;
+        uint32_t before = mode_bits();
+        if (options.tree) {
+            out << "error: modes cannot change in tree splitting mode\n";
+        } else if (arg == "fair" && (value == "on" || value == "off")) {
+            options.fair = value == "on";
+        } else if (arg == "priority" && (value == "strict" || value == "weighted" || value == "none")) {
+            options.priority = value == "strict" ? PRIORITY_STRICT : value == "weighted" ? PRIORITY_WEIGHTED : PRIORITY_NONE;
+        } else if (arg == "slotted" && (value == "on" || value == "off") && !options.switched) {
+            options.slotted = value == "on";
+        } else {
+            out << "error: usage: mode fair on|off, mode priority strict|weighted|none, mode slotted on|off\n";
+        }
+        // Apply the new modes through set_mode_bits(), like a replay will.
+        uint32_t after = mode_bits();
+        options.fair = before & 1;
+        options.priority = (PriorityMode)((before >> 1) & 3);
+        options.slotted = before & 8;
+        if (after != before) {
+            set_mode_bits(after);
+            record_event(EVENT_MODE, servers.size(), nullptr, after);
+        }
+        if (out.str().empty()) out << "ok\n";
+    } else if (command == "trace" && (arg == "on" || arg == "off")) {
+        client.tracing = arg == "on";
+        out << "ok\n";
+    } else if (command == "help") {
+        out << "stats | servers | reset | slot-time MS | kick INDEX|IP:PORT"
+               " | mode fair on|off | mode priority strict|weighted|none | mode slotted on|off | trace on|off\n";
+    } else {
+        out << "error: unknown command " << line << " (try help)\n";
+    }
+    client.out += out.str();
+}
+
+// Gets a path.
+// Creates a Unix-domain listening socket there for admin clients.
+// Returns the socket, or -1 on failure.
+int setup_admin(const char* path) {
+    sockaddr_un addr{};
+    if (strlen(path) >= sizeof(addr.sun_path)) return -1;
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener == -1) return -1;
+    if (bind(listener, (sockaddr*)&addr, sizeof(addr)) == -1 || listen(listener, 16) == -1) {
+        close(listener);
+        return -1;
+    }
+    fcntl(listener, F_SETFL, O_NONBLOCK);
+    return listener;
+}
+
+// Adds the admin sockets to the sets of fd's to wait for: the listening
+// socket and every client for reading, and the clients with a pending answer
+// for writing.
+void add_admin_fds(fd_set& readable, fd_set& writable, int& maxfd) {
+    if (admin_listener < 0) return;
+    FD_SET(admin_listener, &readable);
+    maxfd = max(maxfd, admin_listener);
+    for (auto& client : admins) {
+        FD_SET(client.fd, &readable);
+        if (!client.out.empty()) FD_SET(client.fd, &writable);
+        maxfd = max(maxfd, client.fd);
+    }
+}
+
+// Accepts new admin clients, runs the commands they sent, and sends them
+// as much of their answers as their sockets take without blocking.
+void handle_admin(const fd_set& readable, const fd_set& writable) {
+    if (admin_listener < 0) return;
+    if (FD_ISSET(admin_listener, &readable)) {
+        int fd = accept(admin_listener, nullptr, nullptr);
+        if (fd >= 0) {
+            fcntl(fd, F_SETFL, O_NONBLOCK);
+            AdminClient client;
+            client.fd = fd;
+            admins.push_back(client);
+        }
+    }
+    for (auto& client : admins) {
+        if (FD_ISSET(client.fd, &readable)) {
+            char buff[1024];
+            ssize_t res = recv(client.fd, buff, sizeof buff, 0);
+            if (res == 0 || (res < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                client.closed = true;
+                continue;
+            }
+            if (res > 0) client.in.append(buff, res);
+            size_t newline;
+            while ((newline = client.in.find('\n')) != string::npos) {
+                string line = client.in.substr(0, newline);
+                client.in.erase(0, newline + 1);
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                run_admin_command(client, line);
+            }
+            if (client.in.size() > ADMIN_MAX_LINE) client.closed = true;
+        }
+        if (FD_ISSET(client.fd, &writable) && !client.out.empty()) {
+            ssize_t sent = send(client.fd, client.out.data(), client.out.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (sent > 0) client.out.erase(0, sent);
+            else if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) client.closed = true;
+        }
+    }
+    for (size_t i = 0; i < admins.size();) {
+        if (!admins[i].closed) {
+            i++;
+            continue;
+        }
+        close(admins[i].fd);
+        admins.erase(admins.begin() + i);
+    }
+}
+
+// Longest time the channel keeps running to drain its queues when stopping, in milliseconds.
+#define DRAIN_LIMIT_MS 5000
+
+// Gets the listening socket.
+// Stops accepting servers and delivers what the channel still holds (the
+// current slot, switch queues and delayed deliveries), for at most
+// DRAIN_LIMIT_MS; frames still arriving are ignored.
+void drain_channel(int listener) {
+    close(listener);
+    // Resolve the slot in progress right away.
+    if (options.slotted && !slot_senders.empty()) flush_slot();
+    auto queued = []() {
+        for (auto& server : servers) {
+            if (!server.is_dead && (!server.ingress.empty() || !server.egress.empty())) return true;
+        }
+        return false;
+    };
+    double deadline = now_ms() + DRAIN_LIMIT_MS;
+    while ((deliveries.count > 0 || (options.switched && queued())) && now_ms() < deadline) {
+        this_thread::sleep_for(chrono::milliseconds(1));
+        wake++;
+        update_wake_clock();
+        run_due_deliveries();
+        if (options.switched) {
+            record_event(EVENT_TICK, servers.size(), nullptr);
+            run_switch_slots(options.slot_time);
+        }
+    }
+}
+
+// Blocks SIGTERM, SIGINT, SIGUSR1 and SIGHUP, so that they are read from the returned signalfd instead.
+// Returns the signalfd, or -1 on failure (the signals are then left unblocked).
+int setup_signals() {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGHUP);
+    if (sigprocmask(SIG_BLOCK, &mask, nullptr) == -1) return -1;
+    int signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd < 0) sigprocmask(SIG_UNBLOCK, &mask, nullptr);
+    return signal_fd;
+}
+
+// Gets the signalfd.
+// Handles the pending signals: SIGUSR1 dumps the statistics, SIGHUP reopens
+// the stats log (after rotation).
+// Returns true if SIGTERM or SIGINT asked the channel to stop.
+bool handle_signals(int signal_fd) {
+    bool stop = false;
+    signalfd_siginfo info;
+    while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+        if (info.ssi_signo == SIGTERM || info.ssi_signo == SIGINT) {
+            stop = true;
+        } else if (info.ssi_signo == SIGUSR1) {
+            ostream& out = stats_log.is_open() ? (ostream&)stats_log : cerr;
+            out << "Statistics after " << now_ms() / 1000 << " seconds:" << endl;
+            report_stats();
+        } else if (info.ssi_signo == SIGHUP && options.stats_log && !open_stats_log()) {
+            cerr << "Error: Cannot reopen stats log " << options.stats_log << endl;
+        }
+    }
+    return stop;
+}
+
+// Gets the port argument of the program, already converted to an int.
+// Runs a channel; the slot time is `options.slot_time`, which admin clients may change.
 // Stores statistics about received and sent frames.
-// This function returns when the user pressed CTRL+D (EOF).
-void channel_loop(int port, int slot_time) {
+// This function returns when the user pressed CTRL+D (EOF), or on SIGTERM or
+// SIGINT, after draining the channel.
+// Returns false if it could not start: in daemon mode, signals are the only
+// way to stop the channel, so it does not run without them.
+bool channel_loop(int port) {
     // Create listening port.
     int listener = setup_server(port);
+    int signal_fd = setup_signals();
+    if (signal_fd < 0) {
+        cerr << "Error: Cannot handle signals: " << strerror(errno) << endl;
+        if (options.daemon) {
+            close(listener);
+            return false;
+        }
+    }
 
     // Change stdin mode to non-blocking.
     fcntl(STDIN_FILENO, F_SETFL, O_NONBLOCK);
@@ -59,111 +1554,372 @@ void channel_loop(int port, int slot_time) {
     // Repeatedly listen for requests and serve them (unless there are collisions).
     while (true) {
         // Create the set of fd's to which we want to listen.
-        // These fd's are: stdin, the listening socket, and the servers' sockets.
-        fd_set fds;
+        // These fd's are: stdin (unless in daemon mode), the signalfd, the listening socket,
+        // the servers' sockets and the admin sockets.
+        fd_set fds, writable;
         FD_ZERO(&fds);
-        FD_SET(STDIN_FILENO, &fds);
+        FD_ZERO(&writable);
+        if (!options.daemon) FD_SET(STDIN_FILENO, &fds);
         FD_SET(listener, &fds);
         int maxfd = max(listener, STDIN_FILENO);
+        if (signal_fd >= 0) {
+            FD_SET(signal_fd, &fds);
+            maxfd = max(maxfd, signal_fd);
+        }
         for (auto& server : servers) {
             if (server.is_dead) continue;
             FD_SET(server.sockfd, &fds);
             maxfd = max(maxfd, server.sockfd);
         }
+        add_admin_fds(fds, writable, maxfd);
 
-        // Listen to fd's for slot_time.
-        timeval tv{0, slot_time * 1000};
-        int num_ready = select(maxfd + 1, &fds, nullptr, nullptr, &tv);
-        if (num_ready == 0) continue;
+        // Listen to fd's for slot_time (or 1 millisecond while deliveries are pending or slots are kept).
+        int wait_ms = deliveries.count > 0 || options.slotted ? 1 : options.slot_time;
+        timeval tv{wait_ms / 1000, (wait_ms % 1000) * 1000};
+        int num_ready = select(maxfd + 1, &fds, &writable, nullptr, &tv);
+        wake++;
+        update_wake_clock();
+        run_due_deliveries();
+        bool slot_ended = end_slot_if_due(options.slot_time);
+        sample_channel();
+        evict_unhealthy_servers();
+        if (num_ready == 0) {
+            // Slots ending depend on when the channel woke up; a replay needs those wakes too.
+            if (slot_ended) record_event(EVENT_TICK, servers.size(), nullptr);
+            if (options.switched) {
+                // Switch slots depend on when the channel woke up; a replay needs those wakes too.
+                record_event(EVENT_TICK, servers.size(), nullptr);
+                run_switch_slots(options.slot_time);
+            }
+            continue;
+        }
 #ifdef DEBUG
         cout << "ready: " << num_ready << endl;
 #endif
 
-        // If got EOF in stdin, stop program.
-        if (FD_ISSET(STDIN_FILENO, &fds)) {
+        // If got EOF in stdin, or SIGTERM or SIGINT, stop program.
+        bool stop = false;
+        if (!options.daemon && FD_ISSET(STDIN_FILENO, &fds)) {
             char buff;
-            if (read(STDIN_FILENO, &buff, sizeof buff) == 0) {
-                break;
-            }
+            if (read(STDIN_FILENO, &buff, sizeof buff) == 0) stop = true;
+        }
+        if (signal_fd >= 0 && FD_ISSET(signal_fd, &fds) && handle_signals(signal_fd)) stop = true;
+        if (stop) {
+            drain_channel(listener);
+            record_event(EVENT_END, servers.size(), nullptr);
+            break;
         }
 
         // If the listener got a new server, add it to the list of servers.
-        if (FD_ISSET(listener, &fds)) {
-            sockaddr_in cli_addr;
-            socklen_t len = sizeof(cli_addr);
-            int server_sock = accept(listener, (sockaddr*)&cli_addr, &len);
+        sockaddr_in cli_addr;
+        socklen_t len = sizeof(cli_addr);
+        int server_sock = FD_ISSET(listener, &fds) ? accept(listener, (sockaddr*)&cli_addr, &len) : -1;
+        if (server_sock >= 0) {
             fcntl(server_sock, F_SETFL, O_NONBLOCK);
-            servers.push_back({cli_addr, server_sock});
-        }
-
-        // Receive frames from all servers that sent a frame.
-        // Create a vector of servers that sent a frame.
-        Frame received_frame;
-        vector<ServerInfo*> ready;
-        for (auto &server : servers) {
-            if (server.is_dead || !FD_ISSET(server.sockfd, &fds)) continue;
-            int res = recv(server.sockfd, &received_frame, sizeof(Frame), 0);
-            if (res == 0) {
-                server.is_dead = true;
-                continue;
-            }
-            ready.push_back(&server);
+            // Several frames may be sent to a server per slot; don't let Nagle delay them.
+            int nodelay = 1;
+            setsockopt(server_sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+            set_keepalive(server_sock);
+            add_server(cli_addr, server_sock);
         }
 
-        // If exactly one frame was received, there is no collision.
-        if (ready.size() == 1) {
-            // Resend frame to all connected (and alive) servers.
-            for (auto& server : servers) {
-                if (server.is_dead) continue;
-#ifdef DEBUG
-                static int num_acks;
-                num_acks++;
-                cout << "Going to send ACK no. " << num_acks << endl;
-#endif
-                send(server.sockfd, &received_frame, sizeof(FrameHeader) + received_frame.header.payload_length, 0);
-            }
-            // Increment frame count on the sending server.
-            ready[0]->frames++;
-        }
-        // If more than one frame was received, there is a collision.
-        else if (ready.size() > 1) {
-            // Increment collision count on all servers that participated in the collision.
-            for (auto& server : ready) {
-                if (server->is_dead) continue;
-                server->collisions++;
-            }
-            // Send a noise frame to everyone.
-            Frame noise;
-            create_noise_frame(noise);
-            for (auto& server : servers) {
-                if (server.is_dead) continue;
-                send(server.sockfd, &noise, sizeof(noise), 0);
-            }
+        // Receive frames from all servers that sent a whole frame, and drop the unhealthy ones.
+        vector<ServerInfo*> ready = receive_frames(fds);
+        frames_arrived(ready, options.slot_time);
+
+        // Admin commands run after the frames of this wake, so a replay can apply them in the same order.
+        handle_admin(fds, writable);
+        publish_shm_stats();
+    }
+    return true;
+}
+
+// Gets a recorded admin command.
+// Applies it like the admin socket did.
+void replay_command(const SessionRecord& record) {
+    switch (record.event) {
+    case EVENT_KICK:
+        kick_server(servers[record.server]);
+        break;
+    case EVENT_RESET:
+        reset_stats();
+        break;
+    case EVENT_SLOT_TIME:
+        options.slot_time = record.address;
+        break;
+    case EVENT_MODE:
+        set_mode_bits(record.address);
+        break;
+    }
+}
+
+// Gets the path of a session log.
+// Re-runs the recorded session through the channel's decision logic as fast
+// as possible: the clock jumps from one recorded wake to the next, and frames
+// arrive in exactly the recorded groups. Payloads are not recorded, so the
+// replayed frames carry only their headers.
+// Returns true on success, or false if the log cannot be read.
+bool replay_loop(const char* path) {
+    SessionLogHeader header;
+    FILE* file = open_session_log(path, header);
+    if (!file) {
+        cerr << "Error: Cannot read session log " << path << endl;
+        return false;
+    }
+    auto begin = chrono::steady_clock::now();
+    SessionRecord record;
+    vector<ServerInfo*> ready;
+    vector<SessionRecord> commands;    // admin commands of the current wake, run after its frames
+    uint32_t current_wake = 0;
+    bool has_arrivals = false;      // the current wake read from the servers' sockets
+    size_t events = 0;
+    bool ended = false;
+    while (!ended && read_session_record(file, record)) {
+        events++;
+        // A new wake: handle the previous wake's arrivals, then move the clock.
+        if (record.wake != current_wake) {
+            if (has_arrivals) frames_arrived(ready, options.slot_time);
+            for (auto& command : commands) replay_command(command);
+            ready.clear();
+            commands.clear();
+            has_arrivals = false;
+            current_wake = record.wake;
+            wake_clock = record.time_us / 1000.0;
+            run_due_deliveries();
+            end_slot_if_due(options.slot_time);
+            sample_channel();
+        }
+        if ((record.event == EVENT_ARRIVAL || record.event == EVENT_CLOSE || record.event == EVENT_KICK) &&
+            record.server >= servers.size()) {
+            cerr << "Error: Session log " << path << " refers to unknown server " << record.server << endl;
+            fclose(file);
+            return false;
+        }
+        if (record.event == EVENT_CONNECT || record.event == EVENT_ARRIVAL || record.event == EVENT_CLOSE) {
+            has_arrivals = true;
+        }
+        switch (record.event) {
+        case EVENT_CONNECT: {
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = record.address;
+            addr.sin_port = record.port;
+            add_server(addr, -1);
+            break;
+        }
+        case EVENT_ARRIVAL: {
+            ServerInfo& server = servers[record.server];
+            server.frame.header = record.header;
+            ready.push_back(&server);
+            break;
+        }
+        case EVENT_CLOSE:
+            servers[record.server].is_dead = true;
+            count_close(record.address);
+            break;
+        case EVENT_TICK:
+            if (options.switched) run_switch_slots(options.slot_time);
+            break;
+        case EVENT_KICK:
+        case EVENT_RESET:
+        case EVENT_SLOT_TIME:
+        case EVENT_MODE:
+            commands.push_back(record);
+            break;
+        case EVENT_END:
+            // The channel resolved the slot in progress when it stopped.
+            if (options.slotted && !slot_senders.empty()) flush_slot();
+            ended = true;
+            break;
         }
     }
+    if (has_arrivals) frames_arrived(ready, options.slot_time);
+    for (auto& command : commands) replay_command(command);
+    fclose(file);
+    if (!ended) cerr << "Warning: Session log " << path << " is truncated" << endl;
+    cerr << "Replayed " << events << " events (" << wake_clock / 1000 << " seconds of traffic) in "
+         << chrono::duration<double>(chrono::steady_clock::now() - begin).count() << " seconds" << endl;
+    return true;
 }
 
-// Display statistics about received frames and collisions.
-void report_stats() {
-    for (auto& server : servers) {
-        char ip_str[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &server.addr.sin_addr, ip_str, sizeof(ip_str));
-        cerr << "From " << ip_str << " port " << ntohs(server.addr.sin_port)
-           << ": " /*<< server.frames << " frames, " */<< server.collisions << " collisions" << endl;
+// Gets the optional arguments that follow the positional ones (argv[first] onwards).
+// Parses them into `options`.
+// Returns true on success, or false if an option is unknown or invalid.
+bool parse_options(int argc, char* argv[], int first) {
+    for (int i = first; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--fair") {
+            options.fair = true;
+        } else if (arg == "--priority" && i + 1 < argc) {
+            string mode = argv[++i];
+            if (mode == "strict") options.priority = PRIORITY_STRICT;
+            else if (mode == "weighted") options.priority = PRIORITY_WEIGHTED;
+            else if (mode == "none") options.priority = PRIORITY_NONE;
+            else return false;
+        } else if (arg == "--switch") {
+            options.switched = true;
+        } else if (arg == "--slotted") {
+            options.slotted = true;
+        } else if (arg == "--queue-size" && i + 1 < argc) {
+            options.queue_size = stoul(argv[++i]);
+            if (options.queue_size == 0) return false;
+        } else if (arg == "--subchannels" && i + 1 < argc) {
+            options.subchannels = stoi(argv[++i]);
+            if (options.subchannels < 1 || options.subchannels > 256) return false;
+        } else if (arg == "--loss" && i + 1 < argc) {
+            options.loss = stod(argv[++i]);
+            if (options.loss < 0 || options.loss > 1) return false;
+        } else if (arg == "--delay" && i + 1 < argc) {
+            options.delay = stoi(argv[++i]);
+            if (options.delay < 0) return false;
+        } else if (arg == "--jitter" && i + 1 < argc) {
+            options.jitter = stoi(argv[++i]);
+            if (options.jitter < 0) return false;
+        } else if (arg == "--bandwidth" && i + 1 < argc) {
+            options.bandwidth = stoi(argv[++i]);
+            if (options.bandwidth < 0) return false;
+        } else if (arg == "--ber" && i + 1 < argc) {
+            options.ber = stod(argv[++i]);
+            if (options.ber < 0 || options.ber >= 1) return false;
+        } else if (arg == "--seed" && i + 1 < argc) {
+            options.seed = stoi(argv[++i]);
+        } else if (arg == "--bucket-rate" && i + 1 < argc) {
+            options.bucket_rate = stod(argv[++i]);
+            if (options.bucket_rate < 0) return false;
+        } else if (arg == "--bucket-size" && i + 1 < argc) {
+            options.bucket_size = stod(argv[++i]);
+            if (options.bucket_size <= 0) return false;
+        } else if (arg == "--record" && i + 1 < argc) {
+            options.record = argv[++i];
+        } else if (arg == "--replay" && i + 1 < argc) {
+            options.replay = argv[++i];
+        } else if (arg == "--admin" && i + 1 < argc) {
+            options.admin = argv[++i];
+        } else if (arg == "--daemon") {
+            options.daemon = true;
+        } else if (arg == "--stats-log" && i + 1 < argc) {
+            options.stats_log = argv[++i];
+        } else if (arg == "--shm" && i + 1 < argc) {
+            options.shm = argv[++i];
+        } else if (arg == "--samples" && i + 1 < argc) {
+            options.samples = argv[++i];
+        } else if (arg == "--sample-interval" && i + 1 < argc) {
+            options.sample_interval = stoi(argv[++i]);
+            if (options.sample_interval < 1) return false;
+        } else if (arg == "--sample-format" && i + 1 < argc) {
+            string format = argv[++i];
+            if (format != "csv" && format != "json") return false;
+            options.samples_json = format == "json";
+        } else if (arg == "--sample-live") {
+            options.samples_live = true;
+        } else if (arg == "--json" && i + 1 < argc) {
+            options.json = argv[++i];
+        } else if (arg == "--idle-timeout" && i + 1 < argc) {
+            options.idle_timeout = stoi(argv[++i]);
+            if (options.idle_timeout < 0) return false;
+        } else if (arg == "--burst" && i + 1 < argc) {
+            options.burst = stoi(argv[++i]);
+            if (options.burst < 1) return false;
+        } else if (arg == "--burst-bytes" && i + 1 < argc) {
+            // stoul would wrap a negative value around to a huge limit.
+            long long bytes = stoll(argv[++i]);
+            if (bytes < 1 || bytes > UINT32_MAX) return false;
+            options.burst_bytes = bytes;
+        } else if (arg == "--dedup") {
+            options.dedup = true;
+        } else if (arg == "--tree") {
+            options.tree = true;
+            options.slotted = true;
+        } else if (arg == "--keepalive" && i + 1 < argc) {
+            options.keepalive = stoi(argv[++i]);
+            if (options.keepalive < 0) return false;
+        } else {
+            return false;
+        }
     }
-#ifdef DEBUG
-    cout << "end of report" << endl;
-#endif
-    exit(0);
+    // Tree splitting needs every slot to have a single, plain outcome.
+    bool tree_conflict = options.tree && (options.fair || options.priority != PRIORITY_NONE || options.burst > 1);
+    return !(options.record && options.replay) && !(options.slotted && options.switched) && !tree_conflict;
 }
 
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        cerr << "Usage: ./my_channel.exe <chan_port> <slot_time>" << endl;
+    if (argc < 3 || !parse_options(argc, argv, 3)) {
+        cerr << "Usage: ./my_channel.exe <chan_port> <slot_time> [--fair] [--bucket-rate R] [--bucket-size B]"
+                " [--priority strict|weighted|none] [--seed S] [--slotted | --switch [--queue-size N]]"
+                " [--subchannels K] [--loss P] [--delay MS] [--jitter MS] [--bandwidth BYTES] [--ber P]"
+                " [--record PATH | --replay PATH] [--admin PATH] [--daemon] [--stats-log PATH] [--shm NAME]"
+                " [--samples PATH [--sample-interval MS] [--sample-format csv|json] [--sample-live]]"
+                " [--json PATH|-] [--idle-timeout MS] [--keepalive S] [--dedup] [--tree]"
+                " [--burst K [--burst-bytes B]]" << endl;
         return 1;
     }
     signal(SIGPIPE, SIG_IGN);
-    channel_loop(stoi(argv[1]), stoi(argv[2]));
+    options.slot_time = stoi(argv[2]);
+    if (options.replay) {
+        // The recorded timestamps and random decisions only make sense with the recorded slot time and seed.
+        SessionLogHeader header;
+        FILE* file = open_session_log(options.replay, header);
+        if (!file) {
+            cerr << "Error: Cannot read session log " << options.replay << endl;
+            return 1;
+        }
+        fclose(file);
+        options.slot_time = header.slot_time;
+        options.seed = header.seed;
+    }
+    rng.seed(options.seed);
+    impair_rng.seed(options.seed);
+    subchannel_stats.resize(options.subchannels);
+    if (options.stats_log && !open_stats_log()) {
+        cerr << "Error: Cannot open stats log " << options.stats_log << endl;
+        return 1;
+    }
+    if (options.samples) {
+        if (!open_sampler(sampler, options.samples, options.samples_json)) {
+            cerr << "Error: Cannot create samples file " << options.samples << endl;
+            return 1;
+        }
+        sampler.interval_ms = options.sample_interval;
+        sampler.live = options.samples_live;
+    }
+    if (options.replay) {
+        if (!replay_loop(options.replay)) return 1;
+    } else {
+        if (options.record) {
+            session_log = create_session_log(options.record, options.slot_time, options.seed);
+            if (!session_log) {
+                cerr << "Error: Cannot create session log " << options.record << endl;
+                return 1;
+            }
+        }
+        if (options.admin) {
+            admin_listener = setup_admin(options.admin);
+            if (admin_listener < 0) {
+                cerr << "Error: Cannot create admin socket " << options.admin << endl;
+                return 1;
+            }
+        }
+        if (options.shm) {
+            stats_segment = open_stats_segment(options.shm);
+            if (!stats_segment) {
+                cerr << "Error: Cannot open shared-memory stats " << options.shm << endl;
+                return 1;
+            }
+            channel_stat = claim_stat_slot(stats_segment, STAT_CHANNEL, "channel port " + string(argv[1]));
+        }
+        bool ran = channel_loop(stoi(argv[1]));
+        if (options.admin) unlink(options.admin);
+        publish_shm_stats();
+        for (auto& server : servers) release_stat_slot(server.stat);
+        release_stat_slot(channel_stat);
+        if (session_log) fclose(session_log);
+        if (!ran) return 1;
+    }
+    // A last sample, so the time series ends with the final totals.
+    if (sampler.out) sampler.next_ms = 0;
+    sample_channel();
+    close_sampler(sampler);
     report_stats();
+    write_json_report(options.replay ? 0 : stoi(argv[1]));
     return 0;
 }
@@ -0,0 +1,117 @@
+// checkpoint.h
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "protocol.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <algorithm>
+#include <vector>
+
+#define CHECKPOINT_MAGIC "aloha-checkpoint-v1"
+#define CHECKPOINT_FLUSH_EVERY 64
+
+// Progress log of a transfer, used to resume it after a failure.
+// The file starts with a header line describing the transfer,
+// followed by "ack <first> <last>" lines appended as frames are acknowledged.
+struct Checkpoint {
+    FILE* file = nullptr;
+    uint64_t file_hash = 0;
+    uint64_t file_size = 0;
+    uint32_t frame_size = 0;
+    std::vector<uint32_t> pending;      // acked seq numbers not yet written
+};
+
+// Gets the frames of a file.
+// Returns a 64-bit FNV-1a hash of their payloads.
+inline uint64_t hash_frames(const std::vector<Frame>& frames) {
+    uint64_t hash = 1469598103934665603ULL;
+    for (auto& frame : frames) {
+        for (uint32_t i = 0; i < frame.header.payload_length; i++) {
+            hash ^= (uint8_t)frame.payload[i];
+            hash *= 1099511628211ULL;
+        }
+    }
+    return hash;
+}
+
+// Gets a checkpoint path and the parameters of the transfer.
+// If the file exists and was written for the same transfer, marks the frames
+// it lists in `done` and returns how many there are; otherwise returns 0.
+inline size_t load_checkpoint(const char* path, uint64_t file_hash, uint64_t file_size, uint32_t frame_size,
+                              std::vector<uint8_t>& done) {
+    FILE* file = fopen(path, "r");
+    if (!file) return 0;
+    char magic[32];
+    uint64_t hash, size;
+    uint32_t fsize;
+    size_t count = 0;
+    if (fscanf(file, "%31s %" SCNx64 " %" SCNu64 " %" SCNu32, magic, &hash, &size, &fsize) == 4 &&
+        strcmp(magic, CHECKPOINT_MAGIC) == 0 && hash == file_hash && size == file_size && fsize == frame_size) {
+        uint32_t first, last;
+        while (fscanf(file, " ack %" SCNu32 " %" SCNu32, &first, &last) == 2) {
+            for (uint32_t seq = first; seq <= last && seq < done.size(); seq++) {
+                if (!done[seq]) count++;
+                done[seq] = 1;
+            }
+        }
+    }
+    fclose(file);
+    return count;
+}
+
+// Gets a checkpoint and the parameters of the transfer.
+// Opens the checkpoint file at `path` for appending.
+// Unless `resume` is set (and the file was loaded successfully), the file is
+// truncated and a fresh header is written.
+// Returns true on success, or false otherwise.
+inline bool open_checkpoint(Checkpoint& checkpoint, const char* path, bool resume,
+                            uint64_t file_hash, uint64_t file_size, uint32_t frame_size) {
+    checkpoint.file_hash = file_hash;
+    checkpoint.file_size = file_size;
+    checkpoint.frame_size = frame_size;
+    checkpoint.file = fopen(path, resume ? "a" : "w");
+    if (!checkpoint.file) return false;
+    if (!resume) {
+        fprintf(checkpoint.file, "%s %" PRIx64 " %" PRIu64 " %" PRIu32 "\n",
+                CHECKPOINT_MAGIC, file_hash, file_size, frame_size);
+        fflush(checkpoint.file);
+    }
+    return true;
+}
+
+// Writes the pending acked seq numbers to the checkpoint file as ranges.
+inline void flush_checkpoint(Checkpoint& checkpoint) {
+    if (!checkpoint.file || checkpoint.pending.empty()) return;
+    std::sort(checkpoint.pending.begin(), checkpoint.pending.end());
+    uint32_t first = checkpoint.pending[0], last = first;
+    for (size_t i = 1; i <= checkpoint.pending.size(); i++) {
+        if (i < checkpoint.pending.size() && checkpoint.pending[i] == last + 1) {
+            last++;
+            continue;
+        }
+        fprintf(checkpoint.file, "ack %" PRIu32 " %" PRIu32 "\n", first, last);
+        if (i < checkpoint.pending.size()) first = last = checkpoint.pending[i];
+    }
+    fflush(checkpoint.file);
+    checkpoint.pending.clear();
+}
+
+// Records that the frame with the given seq number was acknowledged.
+// The record is written to disk once CHECKPOINT_FLUSH_EVERY records are pending.
+inline void checkpoint_ack(Checkpoint& checkpoint, uint32_t seq) {
+    if (!checkpoint.file) return;
+    checkpoint.pending.push_back(seq);
+    if (checkpoint.pending.size() >= CHECKPOINT_FLUSH_EVERY) flush_checkpoint(checkpoint);
+}
+
+// Writes any pending records and closes the checkpoint file.
+inline void close_checkpoint(Checkpoint& checkpoint) {
+    if (!checkpoint.file) return;
+    flush_checkpoint(checkpoint);
+    fclose(checkpoint.file);
+    checkpoint.file = nullptr;
+}
+
+#endif
@@ -0,0 +1,314 @@
+// curve.cpp
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <signal.h>
+
+using namespace std;
+
+// Options that may follow the positional arguments on the command line.
+struct CurveOptions {
+    double min_rate = 0.05;         // lowest total offered rate, in frames per slot
+    double max_rate = 2;            // highest total offered rate, in frames per slot
+    int points = 10;                // number of offered rates measured
+    double duration = 500;          // slots of generated traffic per measurement
+    int frame_size = 500;
+    string traffic = "poisson";     // traffic model of the senders
+    vector<string> channel_args;    // extra flags for the channel (e.g. --fair)
+    vector<string> server_args;     // extra flags for every sender
+};
+
+// One measurement: the channel's load at one offered rate.
+struct CurvePoint {
+    double rate;                    // total rate of new frames offered by the senders, per slot
+    uint64_t slots = 0;
+    uint64_t successes = 0;
+    uint64_t collisions = 0;
+    uint64_t idle = 0;
+    uint64_t frames = 0;            // transmission attempts, including retransmissions
+    double G = 0;                   // attempts per slot
+    double S = 0;                   // successful slots per slot
+};
+
+// Returns the throughput of pure ALOHA at offered load G: G e^(-2G).
+double pure_aloha(double G) {
+    return G * exp(-2 * G);
+}
+
+// Returns the throughput of slotted ALOHA at offered load G: G e^(-G).
+double slotted_aloha(double G) {
+    return G * exp(-G);
+}
+
+// Gets the arguments of a program, and the fds to use as its stdin and stderr.
+// Starts the program, with its stdout discarded.
+// Returns its process ID, or -1 on failure.
+pid_t spawn(const vector<string>& args, int stdin_fd, int stderr_fd) {
+    pid_t pid = fork();
+    if (pid != 0) return pid;
+    int null_fd = open("/dev/null", O_RDWR);
+    dup2(stdin_fd >= 0 ? stdin_fd : null_fd, STDIN_FILENO);
+    dup2(null_fd, STDOUT_FILENO);
+    dup2(stderr_fd >= 0 ? stderr_fd : null_fd, STDERR_FILENO);
+    vector<char*> argv;
+    for (auto& arg : args) argv.push_back((char*)arg.c_str());
+    argv.push_back(nullptr);
+    execv(argv[0], argv.data());
+    _exit(127);
+}
+
+// Gets a line of the channel's report, such as "Slots: 12 elapsed, 3 idle, ...", and a name.
+// Returns the number just before that name (e.g. 3 for "idle"), or -1 if the name is not in the line.
+int64_t report_field(const string& line, const string& name) {
+    istringstream words(line);
+    string previous, word;
+    while (words >> word) {
+        if (!word.empty() && word.back() == ',') word.pop_back();
+        if (word == name) {
+            char* end;
+            uint64_t value = strtoull(previous.c_str(), &end, 10);
+            return previous.empty() || *end ? -1 : (int64_t)value;
+        }
+        previous = word;
+    }
+    return -1;
+}
+
+// Gets the directory of the binaries, the positional arguments and the options.
+// Runs a (slotted) channel and `senders` load generators offering `point.rate` frames
+// per slot in total, then stops the channel and parses its slot counts into `point`.
+// Returns true on success, or false if the channel did not report its load.
+bool run_point(const string& dir, int port, int slot_time, const string& filename, int senders,
+               const CurveOptions& options, CurvePoint& point) {
+    int stdin_pipe[2], stderr_pipe[2];
+    // Close-on-exec, so that only the channel holds the ends it was given.
+    if (pipe2(stdin_pipe, O_CLOEXEC) == -1 || pipe2(stderr_pipe, O_CLOEXEC) == -1) return false;
+
+    // S is measured in successes per slot, which only means something when frames are sent in slots.
+    vector<string> channel = {dir + "my_channel", to_string(port), to_string(slot_time), "--slotted"};
+    channel.insert(channel.end(), options.channel_args.begin(), options.channel_args.end());
+    pid_t channel_pid = spawn(channel, stdin_pipe[0], stderr_pipe[1]);
+    close(stdin_pipe[0]);
+    close(stderr_pipe[1]);
+
+    // The senders retry connecting until the channel listens.
+    vector<pid_t> sender_pids;
+    for (int i = 0; i < senders; i++) {
+        vector<string> sender = {dir + "my_Server", "127.0.0.1", to_string(port), filename,
+                                 to_string(options.frame_size), to_string(slot_time), to_string(i + 1),
+                                 to_string(2 * slot_time) + "ms", "--traffic", options.traffic,
+                                 "--rate", to_string(point.rate / senders), "--duration", to_string(options.duration)};
+        sender.insert(sender.end(), options.server_args.begin(), options.server_args.end());
+        sender_pids.push_back(spawn(sender, -1, -1));
+    }
+    for (pid_t pid : sender_pids) waitpid(pid, nullptr, 0);
+
+    // Stop the channel (EOF on its stdin) and read its report.
+    close(stdin_pipe[1]);
+    string report;
+    char buff[4096];
+    ssize_t n;
+    while ((n = read(stderr_pipe[0], buff, sizeof buff)) > 0) report.append(buff, n);
+    close(stderr_pipe[0]);
+    waitpid(channel_pid, nullptr, 0);
+
+    istringstream lines(report);
+    string line;
+    while (getline(lines, line)) {
+        // Other modes add fields to the line (e.g. "deferred" with --burst), so find each one by name.
+        if (line.compare(0, 6, "Slots:") != 0) continue;
+        int64_t slots = report_field(line, "elapsed"), successes = report_field(line, "successful"),
+                collisions = report_field(line, "collision"), idle = report_field(line, "idle"),
+                frames = report_field(line, "frames");
+        if (slots <= 0 || successes < 0 || collisions < 0 || idle < 0 || frames < 0) return false;
+        point.slots = slots;
+        point.successes = successes;
+        point.collisions = collisions;
+        point.idle = idle;
+        point.frames = frames;
+        point.G = (double)point.frames / point.slots;
+        point.S = (double)point.successes / point.slots;
+        return true;
+    }
+    return false;
+}
+
+// Writes the measurements and the theoretical throughputs at the measured loads to a CSV file.
+void write_csv(const string& path, const vector<CurvePoint>& points) {
+    ofstream out(path);
+    out << "offered_rate,G,S,successful_slots,collision_slots,idle_slots,slots,pure_aloha_S,slotted_aloha_S" << endl;
+    for (auto& p : points) {
+        out << p.rate << "," << p.G << "," << p.S << "," << p.successes << "," << p.collisions << ","
+            << p.idle << "," << p.slots << "," << pure_aloha(p.G) << "," << slotted_aloha(p.G) << endl;
+    }
+}
+
+// Gets the measurements and the largest G and S to show.
+// Prints the S-vs-G plot as text: '*' for measurements, 'p' for pure ALOHA
+// and 's' for slotted ALOHA.
+void print_text_plot(const vector<CurvePoint>& points, double max_G, double max_S) {
+    const int width = 64, height = 20;
+    vector<string> grid(height, string(width, ' '));
+    auto plot = [&](double G, double S, char mark) {
+        int x = (int)round(G / max_G * (width - 1));
+        int y = (int)round(S / max_S * (height - 1));
+        if (x < 0 || x >= width || y < 0 || y >= height) return;
+        grid[height - 1 - y][x] = mark;
+    };
+    for (int x = 0; x < width; x++) {
+        double G = max_G * x / (width - 1);
+        plot(G, pure_aloha(G), 'p');
+        plot(G, slotted_aloha(G), 's');
+    }
+    for (auto& p : points) plot(p.G, p.S, '*');
+
+    for (int row = 0; row < height; row++) {
+        double S = max_S * (height - 1 - row) / (height - 1);
+        printf("%5.2f |%s\n", S, grid[row].c_str());
+    }
+    printf("      +%s\n", string(width, '-').c_str());
+    printf("       0%*s%.2f  (G: attempts per slot)\n", width - 5, "", max_G);
+    printf("S: successes per slot; * measured, p pure ALOHA (G e^-2G), s slotted ALOHA (G e^-G)\n");
+}
+
+// Gets the measurements and the largest G and S to show.
+// Writes the S-vs-G plot to an SVG file, with the theoretical curves of pure
+// and slotted ALOHA.
+void write_svg(const string& path, const vector<CurvePoint>& points, double max_G, double max_S) {
+    const double width = 640, height = 400, margin = 50;
+    auto x_of = [&](double G) { return margin + G / max_G * (width - 2 * margin); };
+    auto y_of = [&](double S) { return height - margin - S / max_S * (height - 2 * margin); };
+    ofstream out(path);
+    out << "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"" << width << "\" height=\"" << height << "\">\n";
+    out << "<rect width=\"100%\" height=\"100%\" fill=\"white\"/>\n";
+
+    // Axes, with a tick every tenth of each range.
+    out << "<path d=\"M" << margin << " " << margin << " V" << height - margin << " H" << width - margin
+        << "\" stroke=\"black\" fill=\"none\"/>\n";
+    for (int i = 0; i <= 10; i++) {
+        double G = max_G * i / 10, S = max_S * i / 10;
+        out << "<text x=\"" << x_of(G) << "\" y=\"" << height - margin + 16 << "\" font-size=\"10\" text-anchor=\"middle\">"
+            << round(G * 100) / 100 << "</text>\n";
+        out << "<text x=\"" << margin - 6 << "\" y=\"" << y_of(S) + 3 << "\" font-size=\"10\" text-anchor=\"end\">"
+            << round(S * 100) / 100 << "</text>\n";
+    }
+    out << "<text x=\"" << width / 2 << "\" y=\"" << height - 12 << "\" font-size=\"12\" text-anchor=\"middle\">"
+        << "G (attempts per slot)</text>\n";
+    out << "<text x=\"14\" y=\"" << height / 2 << "\" font-size=\"12\" text-anchor=\"middle\" transform=\"rotate(-90 14 "
+        << height / 2 << ")\">S (successes per slot)</text>\n";
+
+    // Theoretical curves.
+    const char* colors[2] = {"#1f77b4", "#2ca02c"};
+    for (int curve = 0; curve < 2; curve++) {
+        out << "<polyline fill=\"none\" stroke=\"" << colors[curve] << "\" points=\"";
+        for (int i = 0; i <= 200; i++) {
+            double G = max_G * i / 200;
+            out << x_of(G) << "," << y_of(curve == 0 ? pure_aloha(G) : slotted_aloha(G)) << " ";
+        }
+        out << "\"/>\n";
+    }
+
+    // Measurements.
+    for (auto& p : points) {
+        out << "<circle cx=\"" << x_of(p.G) << "\" cy=\"" << y_of(p.S) << "\" r=\"3\" fill=\"#d62728\"/>\n";
+    }
+
+    // Legend.
+    const char* labels[3] = {"pure ALOHA", "slotted ALOHA", "measured"};
+    const char* legend_colors[3] = {colors[0], colors[1], "#d62728"};
+    for (int i = 0; i < 3; i++) {
+        double y = margin + 14 * i;
+        out << "<rect x=\"" << width - margin - 110 << "\" y=\"" << y - 8 << "\" width=\"10\" height=\"10\" fill=\""
+            << legend_colors[i] << "\"/>\n";
+        out << "<text x=\"" << width - margin - 95 << "\" y=\"" << y + 1 << "\" font-size=\"11\">" << labels[i] << "</text>\n";
+    }
+    out << "</svg>\n";
+}
+
+// Gets the optional arguments that follow the positional ones (argv[first] onwards).
+// Parses them into `options`.
+// Returns true on success, or false if an option is unknown or invalid.
+bool parse_options(int argc, char* argv[], int first, CurveOptions& options) {
+    for (int i = first; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--min" && i + 1 < argc) {
+            options.min_rate = stod(argv[++i]);
+            if (options.min_rate <= 0) return false;
+        } else if (arg == "--max" && i + 1 < argc) {
+            options.max_rate = stod(argv[++i]);
+        } else if (arg == "--points" && i + 1 < argc) {
+            options.points = stoi(argv[++i]);
+            if (options.points < 1) return false;
+        } else if (arg == "--duration" && i + 1 < argc) {
+            options.duration = stod(argv[++i]);
+            if (options.duration <= 0) return false;
+        } else if (arg == "--frame-size" && i + 1 < argc) {
+            options.frame_size = stoi(argv[++i]);
+            if (options.frame_size <= 0) return false;
+        } else if (arg == "--traffic" && i + 1 < argc) {
+            options.traffic = argv[++i];
+        } else if (arg == "--channel-arg" && i + 1 < argc) {
+            options.channel_args.push_back(argv[++i]);
+        } else if (arg == "--server-arg" && i + 1 < argc) {
+            options.server_args.push_back(argv[++i]);
+        } else {
+            return false;
+        }
+    }
+    return options.max_rate >= options.min_rate;
+}
+
+int main(int argc, char* argv[]) {
+    CurveOptions options;
+    if (argc < 7 || !parse_options(argc, argv, 7, options)) {
+        cerr << "Usage: ./my_curve <chan_port> <slot_time> <file_name> <senders> <csv_path> <svg_path>"
+                " [--min R] [--max R] [--points N] [--duration SLOTS] [--frame-size BYTES]"
+                " [--traffic cbr|poisson|onoff] [--channel-arg ARG]... [--server-arg ARG]..." << endl;
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    // The channel and server binaries are expected next to this one.
+    string self = argv[0];
+    string dir = self.find('/') == string::npos ? "./" : self.substr(0, self.rfind('/') + 1);
+    int port = stoi(argv[1]), slot_time = stoi(argv[2]), senders = stoi(argv[4]);
+    if (senders < 1) {
+        cerr << "Error: At least one sender is needed." << endl;
+        return 1;
+    }
+
+    // Measure offered rates spread geometrically between the two bounds.
+    vector<CurvePoint> points;
+    for (int i = 0; i < options.points; i++) {
+        CurvePoint point;
+        point.rate = options.points == 1 ? options.min_rate
+                                         : options.min_rate * pow(options.max_rate / options.min_rate, (double)i / (options.points - 1));
+        if (!run_point(dir, port, slot_time, argv[3], senders, options, point)) {
+            cerr << "Error: No load report from the channel at rate " << point.rate << endl;
+            continue;
+        }
+        cerr << "Rate " << point.rate << ": G = " << point.G << ", S = " << point.S << " (" << point.successes
+             << " successful, " << point.collisions << " collision, " << point.idle << " idle of " << point.slots
+             << " slots)" << endl;
+        points.push_back(point);
+    }
+    if (points.empty()) return 1;
+
+    double max_G = 3, max_S = 0.5;
+    for (auto& p : points) {
+        max_G = max(max_G, ceil(p.G));
+        max_S = max(max_S, ceil(p.S * 10) / 10);
+    }
+    write_csv(argv[5], points);
+    write_svg(argv[6], points, max_G, max_S);
+    print_text_plot(points, max_G, max_S);
+    return 0;
+}
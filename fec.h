@@ -0,0 +1,195 @@
+// fec.h
+#ifndef FEC_H
+#define FEC_H
+
+#include "protocol.h"
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+// Most shards (data and repair frames together) a block may have: one per element of GF(2^8).
+#define FEC_MAX_SHARDS 256
+
+// Bytes of the payload length stored at the start of every shard.
+#define FEC_LENGTH_SIZE 2
+
+// Header at the start of the payload of a repair frame. The sequence numbers
+// of the block's `k` data frames follow it (a block's frames need not be
+// consecutive), then the shard.
+struct FecHeader {
+    uint32_t block;             // number of the block among those of the sender
+    uint8_t k;                  // data frames in the block
+    uint8_t r;                  // repair frames of the block
+    uint8_t index;              // index of this repair frame among them
+    uint8_t reserved;
+};
+
+// Gets the number of data frames in a block.
+// Returns the bytes a repair frame of that block spends before its shard.
+inline size_t fec_repair_overhead(int k) {
+    return sizeof(FecHeader) + k * sizeof(uint32_t);
+}
+
+// Gets the number of data frames in a block.
+// Returns the largest payload of a data frame that its repair frames can protect.
+inline size_t fec_max_data_size(int k) {
+    return MAX_PAYLOAD_SIZE - fec_repair_overhead(k) - FEC_LENGTH_SIZE;
+}
+
+// Arithmetic in GF(2^8), generated by x^8 + x^4 + x^3 + x^2 + 1.
+// The whole product table is kept, so that multiplying a shard by a constant
+// costs one lookup per byte in the constant's row.
+struct GaloisField {
+    uint8_t mul[256][256];
+    uint8_t inv[256];
+};
+
+// Returns the tables of GF(2^8), built from its exponentials.
+inline GaloisField make_galois_field() {
+    GaloisField field{};
+    uint8_t exp[255];
+    int log[256] = {};
+    int x = 1;
+    for (int i = 0; i < 255; i++) {
+        exp[i] = x;
+        log[x] = i;
+        x <<= 1;
+        if (x & 0x100) x ^= 0x11D;
+    }
+    for (int a = 1; a < 256; a++) {
+        for (int b = 1; b < 256; b++) field.mul[a][b] = exp[(log[a] + log[b]) % 255];
+        field.inv[a] = exp[(255 - log[a]) % 255];
+    }
+    return field;
+}
+
+// Returns the tables of GF(2^8), built on first use.
+inline const GaloisField& galois_field() {
+    static const GaloisField field = make_galois_field();
+    return field;
+}
+
+// Gets two buffers of `size` bytes and a coefficient.
+// Adds `coefficient` times `src` to `dst`.
+inline void gf_mul_add(uint8_t* dst, const uint8_t* src, uint8_t coefficient, size_t size) {
+    if (coefficient == 0) return;
+    if (coefficient == 1) {
+        for (size_t b = 0; b < size; b++) dst[b] ^= src[b];
+        return;
+    }
+    const uint8_t* row = galois_field().mul[coefficient];
+    for (size_t b = 0; b < size; b++) dst[b] ^= row[src[b]];
+}
+
+// Gets the number of data shards of a block, the index of a repair shard and of a data shard.
+// Returns the coefficient of the data shard in the repair shard. The
+// coefficients form a Cauchy matrix, so any K of the data and repair shards
+// determine the data shards.
+inline uint8_t fec_coefficient(int k, int repair, int data) {
+    return galois_field().inv[(k + repair) ^ data];
+}
+
+// Gets a data frame and the shard size of its block.
+// Returns its shard: its payload length (little-endian) and its payload, padded with zeros.
+inline std::vector<uint8_t> fec_shard(const Frame& frame, size_t size) {
+    std::vector<uint8_t> shard(size, 0);
+    shard[0] = frame.header.payload_length & 0xFF;
+    shard[1] = frame.header.payload_length >> 8;
+    memcpy(shard.data() + FEC_LENGTH_SIZE, frame.payload, frame.header.payload_length);
+    return shard;
+}
+
+// Gets a data shard, decoded from its block, and a frame.
+// Sets the frame's payload length and payload from the shard.
+// Returns false if the length does not fit in the shard.
+inline bool fec_unshard(const std::vector<uint8_t>& shard, Frame& frame) {
+    if (shard.size() < FEC_LENGTH_SIZE) return false;
+    uint32_t length = shard[0] | (shard[1] << 8);
+    if (length > shard.size() - FEC_LENGTH_SIZE) return false;
+    frame.header.payload_length = length;
+    memcpy(frame.payload, shard.data() + FEC_LENGTH_SIZE, length);
+    return true;
+}
+
+// Gets the K data shards of a block, `size` bytes each, and a number of repair shards.
+// Computes the repair shards into `repair`.
+inline void fec_encode(const std::vector<const uint8_t*>& data, size_t size, int r,
+                       std::vector<std::vector<uint8_t>>& repair) {
+    int k = data.size();
+    repair.assign(r, std::vector<uint8_t>(size, 0));
+    for (int j = 0; j < r; j++) {
+        for (int i = 0; i < k; i++) gf_mul_add(repair[j].data(), data[i], fec_coefficient(k, j, i), size);
+    }
+}
+
+// Gets the number of data shards of a block, and K distinct shards received
+// of it, `size` bytes each, with their indices (data shards are 0 to K - 1,
+// repair shards K onwards).
+// Reconstructs the data shards into `data` by inverting the rows of the
+// received shards in the code's matrix.
+// Returns false if the shards given do not determine the data shards.
+inline bool fec_decode(int k, const std::vector<int>& indices, const std::vector<const uint8_t*>& shards, size_t size,
+                       std::vector<std::vector<uint8_t>>& data) {
+    if ((int)indices.size() != k) return false;
+    const GaloisField& field = galois_field();
+    // Gauss-Jordan elimination of [rows | identity].
+    std::vector<std::vector<uint8_t>> matrix(k, std::vector<uint8_t>(2 * k, 0));
+    for (int row = 0; row < k; row++) {
+        for (int col = 0; col < k; col++) {
+            matrix[row][col] = indices[row] < k ? indices[row] == col : fec_coefficient(k, indices[row] - k, col);
+        }
+        matrix[row][k + row] = 1;
+    }
+    for (int col = 0; col < k; col++) {
+        int pivot = col;
+        while (pivot < k && matrix[pivot][col] == 0) pivot++;
+        if (pivot == k) return false;
+        std::swap(matrix[pivot], matrix[col]);
+        uint8_t scale = field.inv[matrix[col][col]];
+        for (int c = 0; c < 2 * k; c++) matrix[col][c] = field.mul[scale][matrix[col][c]];
+        for (int row = 0; row < k; row++) {
+            if (row != col) gf_mul_add(matrix[row].data(), matrix[col].data(), matrix[row][col], 2 * k);
+        }
+    }
+    data.assign(k, std::vector<uint8_t>(size, 0));
+    for (int i = 0; i < k; i++) {
+        for (int j = 0; j < k; j++) gf_mul_add(data[i].data(), shards[j], matrix[i][k + j], size);
+    }
+    return true;
+}
+
+// Gets a frame (a copy of the first data frame of a block), the block's
+// numbers, the sequence numbers of its data frames and one of its repair shards.
+// Turns the frame into that repair frame.
+inline void create_repair_frame(Frame& frame, const FecHeader& fec, const std::vector<uint32_t>& seqs,
+                                const std::vector<uint8_t>& shard) {
+    frame.header.payload_type = REPAIR_FLAG;
+    frame.header.payload_length = fec_repair_overhead(fec.k) + shard.size();
+    memcpy(frame.payload, &fec, sizeof(FecHeader));
+    memcpy(frame.payload + sizeof(FecHeader), seqs.data(), fec.k * sizeof(uint32_t));
+    memcpy(frame.payload + fec_repair_overhead(fec.k), shard.data(), shard.size());
+}
+
+// Gets a repair frame.
+// Stores its header and the sequence numbers of its block's data frames in
+// `fec` and `seqs`.
+// Returns a pointer to its shard, or nullptr if the frame is too short to hold them.
+inline const uint8_t* parse_repair_frame(const Frame& frame, FecHeader& fec, std::vector<uint32_t>& seqs) {
+    if (frame.header.payload_length < sizeof(FecHeader)) return nullptr;
+    memcpy(&fec, frame.payload, sizeof(FecHeader));
+    if (fec.k == 0 || frame.header.payload_length <= fec_repair_overhead(fec.k)) return nullptr;
+    seqs.resize(fec.k);
+    memcpy(seqs.data(), frame.payload + sizeof(FecHeader), fec.k * sizeof(uint32_t));
+    return (const uint8_t*)frame.payload + fec_repair_overhead(fec.k);
+}
+
+// Gets a repair frame.
+// Returns its index among the repair frames of its block, or -1 if it is too short to tell.
+inline int fec_repair_index(const Frame& frame) {
+    if (frame.header.payload_length < sizeof(FecHeader)) return -1;
+    FecHeader fec;
+    memcpy(&fec, frame.payload, sizeof(FecHeader));
+    return fec.index;
+}
+
+#endif
@@ -0,0 +1,135 @@
+// fec_test.cpp
+// Checks the GF(2^8) tables and the Reed-Solomon code of fec.h.
+#include "fec.h"
+#include <iostream>
+#include <vector>
+#include <random>
+#include <algorithm>
+
+using namespace std;
+
+// Number of random blocks encoded and decoded by the round-trip check.
+#define ROUND_TRIPS 2000
+
+// Gets two elements of GF(2^8).
+// Returns their product, computed bit by bit (shift and reduce) rather than from the tables.
+uint8_t slow_mul(uint8_t a, uint8_t b) {
+    int product = 0;
+    int x = a;
+    for (int bit = 0; bit < 8; bit++) {
+        if (b & (1 << bit)) product ^= x;
+        x <<= 1;
+        if (x & 0x100) x ^= 0x11D;
+    }
+    return product;
+}
+
+// Checks the product and inverse tables against slow_mul.
+// Returns the number of wrong entries.
+int check_field() {
+    const GaloisField& field = galois_field();
+    int errors = 0;
+    for (int a = 0; a < 256; a++) {
+        for (int b = 0; b < 256; b++) errors += field.mul[a][b] != slow_mul(a, b);
+        if (a > 0) errors += field.mul[a][field.inv[a]] != 1;
+    }
+    return errors;
+}
+
+// Gets a random engine, the size of a block and the size of its shards.
+// Encodes `k` random data shards with `r` repair shards, then decodes them
+// from `k` shards picked at random among the `k + r`.
+// Returns true if the data shards came back unchanged.
+bool round_trip(default_random_engine& rng, int k, int r, size_t size) {
+    vector<vector<uint8_t>> data(k, vector<uint8_t>(size));
+    uniform_int_distribution<int> byte_dist(0, 255);
+    for (auto& shard : data) {
+        for (auto& byte : shard) byte = byte_dist(rng);
+    }
+    vector<const uint8_t*> pointers;
+    for (auto& shard : data) pointers.push_back(shard.data());
+    vector<vector<uint8_t>> repair;
+    fec_encode(pointers, size, r, repair);
+
+    vector<int> indices;
+    for (int i = 0; i < k + r; i++) indices.push_back(i);
+    shuffle(indices.begin(), indices.end(), rng);
+    indices.resize(k);
+    vector<const uint8_t*> shards;
+    for (int i : indices) shards.push_back(i < k ? data[i].data() : repair[i - k].data());
+    vector<vector<uint8_t>> decoded;
+    return fec_decode(k, indices, shards, size, decoded) && decoded == data;
+}
+
+// Checks that a data frame's shard holds its length and payload, that the
+// frame comes back from it, that a repair frame gives back its block's
+// sequence numbers and shard, and that decoding gives up with fewer than K shards.
+// Returns the number of failed checks.
+int check_shards() {
+    int errors = 0;
+    Frame frame;
+    frame.header.payload_length = 300;
+    for (int b = 0; b < 300; b++) frame.payload[b] = b;
+    vector<uint8_t> shard = fec_shard(frame, FEC_LENGTH_SIZE + 400);
+    errors += shard[0] != (300 & 0xFF) || shard[1] != (300 >> 8);
+    for (int b = 0; b < 300; b++) errors += shard[FEC_LENGTH_SIZE + b] != (uint8_t)b;
+    for (int b = 300; b < 400; b++) errors += shard[FEC_LENGTH_SIZE + b] != 0;
+    Frame rebuilt;
+    errors += !fec_unshard(shard, rebuilt) || rebuilt.header.payload_length != 300 ||
+              memcmp(rebuilt.payload, frame.payload, 300) != 0;
+
+    Frame repair = frame;
+    vector<uint32_t> seqs = {7, 9, 12};
+    create_repair_frame(repair, FecHeader{5, 3, 2, 1, 0}, seqs, shard);
+    FecHeader fec;
+    vector<uint32_t> parsed;
+    const uint8_t* repair_shard = parse_repair_frame(repair, fec, parsed);
+    errors += repair_shard == nullptr || fec.block != 5 || fec.k != 3 || fec.index != 1 || parsed != seqs ||
+              repair.header.payload_length != fec_repair_overhead(3) + shard.size() ||
+              memcmp(repair_shard, shard.data(), shard.size()) != 0;
+    repair.header.payload_length = fec_repair_overhead(3);
+    errors += parse_repair_frame(repair, fec, parsed) != nullptr;
+
+    shard[1] = 0xFF;
+    errors += fec_unshard(shard, rebuilt);
+
+    vector<const uint8_t*> shards = {shard.data()};
+    vector<vector<uint8_t>> decoded;
+    errors += fec_decode(2, {0}, shards, shard.size(), decoded);
+    return errors;
+}
+
+int main() {
+    int failures = 0;
+    int field_errors = check_field();
+    if (field_errors > 0) {
+        cerr << "GF(2^8) tables: " << field_errors << " wrong entries" << endl;
+        failures++;
+    }
+
+    default_random_engine rng(1);
+    uniform_int_distribution<size_t> size_dist(1, 512);
+    int bad = 0;
+    for (int t = 0; t < ROUND_TRIPS; t++) {
+        int k = uniform_int_distribution<int>(1, 64)(rng);
+        int r = uniform_int_distribution<int>(1, 16)(rng);
+        bad += !round_trip(rng, k, r, size_dist(rng));
+    }
+    // The largest blocks: every element of the field is a shard index.
+    bad += !round_trip(rng, 1, FEC_MAX_SHARDS - 1, 64);
+    bad += !round_trip(rng, FEC_MAX_SHARDS - 1, 1, 64);
+    bad += !round_trip(rng, FEC_MAX_SHARDS / 2, FEC_MAX_SHARDS / 2, 64);
+    if (bad > 0) {
+        cerr << "Round trips: " << bad << " blocks did not decode to their data" << endl;
+        failures++;
+    }
+
+    int shard_errors = check_shards();
+    if (shard_errors > 0) {
+        cerr << "Shards: " << shard_errors << " failed checks" << endl;
+        failures++;
+    }
+
+    cerr << (failures == 0 ? "FEC tests passed" : "FEC tests failed") << endl;
+    return failures == 0 ? 0 : 1;
+}
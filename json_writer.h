@@ -0,0 +1,126 @@
+// json_writer.h
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <cmath>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Minimal streaming JSON writer for the machine-readable reports.
+// Objects and arrays are opened and closed explicitly; the writer adds the
+// commas and escapes the strings.
+struct JsonWriter {
+    std::ostream& out;
+    std::vector<bool> empty;    // for each open object or array, whether nothing was written to it yet
+};
+
+// Writes the separator before a new member of the innermost object or array,
+// and its name when it is a member of an object (`name` is null in arrays).
+inline void json_key(JsonWriter& json, const char* name) {
+    if (!json.empty.empty()) {
+        if (!json.empty.back()) json.out << ',';
+        json.empty.back() = false;
+    }
+    if (!name) return;
+    json.out << '"' << name << "\":";
+}
+
+// Gets a string.
+// Writes it as a JSON string, escaping quotes, backslashes and control characters.
+inline void json_string(JsonWriter& json, const std::string& text) {
+    json.out << '"';
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            json.out << '\\' << c;
+        } else if ((unsigned char)c < 0x20) {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", (unsigned char)c);
+            json.out << escape;
+        } else {
+            json.out << c;
+        }
+    }
+    json.out << '"';
+}
+
+// Opens an object, as the member `name` of the enclosing object (or an element if null).
+inline void json_begin_object(JsonWriter& json, const char* name = nullptr) {
+    json_key(json, name);
+    json.out << '{';
+    json.empty.push_back(true);
+}
+
+// Opens an array, as the member `name` of the enclosing object (or an element if null).
+inline void json_begin_array(JsonWriter& json, const char* name = nullptr) {
+    json_key(json, name);
+    json.out << '[';
+    json.empty.push_back(true);
+}
+
+// Closes the innermost object.
+inline void json_end_object(JsonWriter& json) {
+    json.empty.pop_back();
+    json.out << '}';
+    if (json.empty.empty()) json.out << '\n';
+}
+
+// Closes the innermost array.
+inline void json_end_array(JsonWriter& json) {
+    json.empty.pop_back();
+    json.out << ']';
+}
+
+// Writes a member (or an element if `name` is null) of each JSON type.
+inline void json_value(JsonWriter& json, const char* name, const std::string& value) {
+    json_key(json, name);
+    json_string(json, value);
+}
+
+inline void json_value(JsonWriter& json, const char* name, const char* value) {
+    json_key(json, name);
+    if (value) {
+        json_string(json, value);
+    } else {
+        json.out << "null";
+    }
+}
+
+inline void json_value(JsonWriter& json, const char* name, bool value) {
+    json_key(json, name);
+    json.out << (value ? "true" : "false");
+}
+
+inline void json_value(JsonWriter& json, const char* name, int64_t value) {
+    json_key(json, name);
+    json.out << value;
+}
+
+inline void json_value(JsonWriter& json, const char* name, uint64_t value) {
+    json_key(json, name);
+    json.out << value;
+}
+
+inline void json_value(JsonWriter& json, const char* name, int value) {
+    json_value(json, name, (int64_t)value);
+}
+
+inline void json_value(JsonWriter& json, const char* name, uint32_t value) {
+    json_value(json, name, (uint64_t)value);
+}
+
+inline void json_value(JsonWriter& json, const char* name, double value) {
+    json_key(json, name);
+    // JSON has no infinities or NaNs.
+    if (std::isfinite(value)) {
+        std::streamsize precision = json.out.precision(12);
+        json.out << value;
+        json.out.precision(precision);
+    } else {
+        json.out << "null";
+    }
+}
+
+#endif
@@ -4,13 +4,28 @@
 
 #include <stdint.h>
 #include <string.h>
+#include <sys/socket.h>
 
 #define HEADER_SIZE sizeof(FrameHeader)
 
 #define NOISE_FLAG 0xFF
 #define DATA_FLAG 0x01
+#define REACK_FLAG 0x02
+#define REPAIR_FLAG 0x03
+#define FEEDBACK_FLAG 0x04
+#define DEFER_FLAG 0x05
 #define IPv4_FLAG 0x0800
 
+// Traffic classes, from lowest to highest priority.
+#define CLASS_BULK 0
+#define CLASS_CONTROL 1
+#define NUM_CLASSES 2
+
+// Outcomes of a slot, as announced by feedback frames (tree splitting).
+#define SLOT_IDLE 0
+#define SLOT_SUCCESS 1
+#define SLOT_COLLISION 2
+
 #define MAX_FRAME_SIZE 4096
 #define MAX_PAYLOAD_SIZE (MAX_FRAME_SIZE - sizeof(FrameHeader))
 
@@ -20,6 +35,8 @@ struct FrameHeader {
     uint8_t source_id[6];                 // source identifier (MAC-style)
     uint16_t ether_type = IPv4_FLAG;      // type of the next layer, like 0x0800 for IPv4
     uint8_t payload_type = DATA_FLAG;     // type of payload, like 0x01 for data or 0XFF for noise
+    uint8_t traffic_class = CLASS_BULK;   // priority class, like CLASS_CONTROL for latency-sensitive frames
+    uint8_t subchannel = 0;               // sub-channel (frequency) the frame is sent on
     uint32_t seq_number;                  // sequence number for ordering
     uint32_t payload_length;              // length of payload
 };
@@ -30,9 +47,19 @@ struct Frame {
     char payload[MAX_PAYLOAD_SIZE];
 };
 
+// Payload of a feedback frame: the outcome of the slot that just ended on the
+// frame's sub-channel, and what is left of the collision resolution interval
+struct SlotFeedback {
+    uint8_t outcome;                      // SLOT_IDLE, SLOT_SUCCESS or SLOT_COLLISION
+    uint8_t split;                        // 1 if the group whose turn is next would surely collide, so splits at once
+    uint8_t reserved[2];
+    uint32_t depth;                       // groups of senders still to transmit before the interval ends
+};
+
 // Function to create a noise frame
 inline void create_noise_frame(Frame& frame) {
     frame.header.payload_type = NOISE_FLAG;
+    frame.header.payload_length = 0;
 }
 
 // Function to check if a frame is a noise frame
@@ -40,4 +67,81 @@ inline bool is_noise_frame(const Frame& frame) {
     return frame.header.payload_type == NOISE_FLAG;
 }
 
+// Function to turn a frame into a compact re-ACK of itself: its header only,
+// sent back to a sender whose frame was already delivered
+inline void create_reack_frame(Frame& frame) {
+    frame.header.payload_type = REACK_FLAG;
+    frame.header.payload_length = 0;
+}
+
+// Function to check if a frame is a re-ACK
+inline bool is_reack_frame(const Frame& frame) {
+    return frame.header.payload_type == REACK_FLAG;
+}
+
+// Function to check if a frame is a repair frame (forward error correction)
+inline bool is_repair_frame(const Frame& frame) {
+    return frame.header.payload_type == REPAIR_FLAG;
+}
+
+// Function to create the feedback frame of a slot on a sub-channel
+inline void create_feedback_frame(Frame& frame, uint8_t subchannel, const SlotFeedback& feedback) {
+    frame.header = FrameHeader{};
+    frame.header.payload_type = FEEDBACK_FLAG;
+    frame.header.subchannel = subchannel;
+    frame.header.payload_length = sizeof(SlotFeedback);
+    memcpy(frame.payload, &feedback, sizeof(SlotFeedback));
+}
+
+// Function to check if a frame is a feedback frame
+inline bool is_feedback_frame(const Frame& frame) {
+    return frame.header.payload_type == FEEDBACK_FLAG && frame.header.payload_length == sizeof(SlotFeedback);
+}
+
+// Function to create the frame telling a sender its frame was deferred on a
+// sub-channel, because another sender holds it for a burst of up to `slots` more slots
+inline void create_defer_frame(Frame& frame, uint8_t subchannel, uint32_t slots) {
+    frame.header = FrameHeader{};
+    frame.header.payload_type = DEFER_FLAG;
+    frame.header.subchannel = subchannel;
+    frame.header.payload_length = sizeof(uint32_t);
+    memcpy(frame.payload, &slots, sizeof(uint32_t));
+}
+
+// Function to check if a frame is a defer frame
+inline bool is_defer_frame(const Frame& frame) {
+    return frame.header.payload_type == DEFER_FLAG && frame.header.payload_length == sizeof(uint32_t);
+}
+
+// Function to get the slots a defer frame asks its sender to wait
+inline uint32_t defer_slots(const Frame& frame) {
+    uint32_t slots;
+    memcpy(&slots, frame.payload, sizeof(uint32_t));
+    return slots;
+}
+
+// Function to get the number of bytes a frame takes on the wire (header and payload)
+inline size_t frame_wire_size(const Frame& frame) {
+    return sizeof(FrameHeader) + frame.header.payload_length;
+}
+
+// Function to receive exactly one frame from a blocking socket
+// Returns the number of bytes read, 0 on EOF, or -1 on error or a malformed frame
+inline int recv_frame(int fd, Frame& frame) {
+    int res = recv(fd, &frame.header, sizeof(FrameHeader), MSG_WAITALL);
+    if (res <= 0) return res;
+    if (res < (int)sizeof(FrameHeader) || frame.header.payload_length > MAX_PAYLOAD_SIZE) return -1;
+    if (frame.header.payload_length == 0) return res;
+    int body = recv(fd, frame.payload, frame.header.payload_length, MSG_WAITALL);
+    if (body < (int)frame.header.payload_length) return -1;
+    return res + body;
+}
+
+// Function to pack a 6-byte identifier into an integer, for use as a table key
+inline uint64_t id_to_key(const uint8_t id[6]) {
+    uint64_t key = 0;
+    for (int i = 0; i < 6; i++) key = (key << 8) | id[i];
+    return key;
+}
+
 #endif
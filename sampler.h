@@ -0,0 +1,123 @@
+// sampler.h
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+// Most samples kept in memory; older ones are overwritten.
+#define SAMPLE_RING_SIZE 65536
+
+// Counters of a process at one point in time, as given to the sampler.
+// The first four are totals since the start; the others are current values.
+struct SampleCounters {
+    uint64_t frames = 0;            // frames delivered (channel) or acked (server)
+    uint64_t bytes = 0;             // payload bytes of those frames
+    uint64_t collisions = 0;        // collision slots (channel) or noise heard (server)
+    uint64_t transmissions = 0;     // frames received (channel) or sent (server), retransmissions included
+    uint32_t in_flight = 0;         // frames waiting for the slot to end or for a delivery (channel), or for an ACK (server)
+    uint32_t backing_off = 0;       // senders (channel) or stripes (server) backing off after a collision
+    uint32_t active = 0;            // connected servers (channel), or stripes still sending (server)
+};
+
+// One sample: the counters, and their rates over the interval since the previous sample.
+struct Sample {
+    uint64_t time_ms = 0;
+    SampleCounters counters;
+    double frames_per_s = 0;
+    double mbps = 0;
+    double collision_rate = 0;      // collisions per transmission during the interval
+};
+
+// Periodic sampler keeping the latest samples in a ring, and optionally
+// writing each one as soon as it is taken.
+struct Sampler {
+    FILE* out = nullptr;            // where the samples are written, or null when not sampling
+    bool json = false;              // JSON lines instead of CSV
+    bool live = false;              // write every sample when it is taken instead of at exit
+    uint64_t interval_ms = 100;
+    uint64_t next_ms = 0;           // when the next sample is due
+    std::vector<Sample> ring;
+    size_t first = 0;               // index of the oldest sample in `ring` once it is full
+    Sample previous{};              // the latest sample, to compute the next one's rates
+    uint64_t dropped = 0;           // samples overwritten before they were written
+};
+
+// Gets a sampler, the path of its output and whether to write JSON lines instead of CSV.
+// Opens the output and writes the CSV header.
+// Returns true on success, or false if the file cannot be created.
+inline bool open_sampler(Sampler& sampler, const char* path, bool json) {
+    sampler.out = fopen(path, "w");
+    if (!sampler.out) return false;
+    sampler.json = json;
+    if (!json) {
+        fprintf(sampler.out, "time_ms,frames,bytes,collisions,transmissions,in_flight,backing_off,active,"
+                             "frames_per_s,mbps,collision_rate\n");
+    }
+    return true;
+}
+
+// Writes one sample in the sampler's format.
+inline void write_sample(Sampler& sampler, const Sample& sample) {
+    const SampleCounters& c = sample.counters;
+    const char* format = sampler.json
+        ? "{\"time_ms\":%llu,\"frames\":%llu,\"bytes\":%llu,\"collisions\":%llu,\"transmissions\":%llu,"
+          "\"in_flight\":%u,\"backing_off\":%u,\"active\":%u,\"frames_per_s\":%.3f,\"mbps\":%.6f,\"collision_rate\":%.4f}\n"
+        : "%llu,%llu,%llu,%llu,%llu,%u,%u,%u,%.3f,%.6f,%.4f\n";
+    fprintf(sampler.out, format, (unsigned long long)sample.time_ms, (unsigned long long)c.frames,
+            (unsigned long long)c.bytes, (unsigned long long)c.collisions, (unsigned long long)c.transmissions,
+            c.in_flight, c.backing_off, c.active, sample.frames_per_s, sample.mbps, sample.collision_rate);
+    if (sampler.live) fflush(sampler.out);
+}
+
+// Checks if a sample is due at `now_ms`.
+inline bool sample_due(const Sampler& sampler, uint64_t now_ms) {
+    return sampler.out && now_ms >= sampler.next_ms;
+}
+
+// Gets the time and the counters of the process.
+// Takes a sample: computes its rates, and writes it or keeps it in the ring.
+inline void take_sample(Sampler& sampler, uint64_t now_ms, const SampleCounters& counters) {
+    Sample sample;
+    sample.time_ms = now_ms;
+    sample.counters = counters;
+    Sample last = sampler.previous;
+    // Counters reset since the previous sample (e.g. by an admin) start over from zero.
+    if (counters.frames < last.counters.frames || counters.bytes < last.counters.bytes ||
+        counters.collisions < last.counters.collisions || counters.transmissions < last.counters.transmissions) {
+        last.counters = SampleCounters();
+    }
+    if (now_ms > last.time_ms) {
+        double seconds = (now_ms - last.time_ms) / 1000.0;
+        sample.frames_per_s = (counters.frames - last.counters.frames) / seconds;
+        sample.mbps = (counters.bytes - last.counters.bytes) * 8 / seconds / 1000000;
+    }
+    uint64_t transmissions = counters.transmissions - last.counters.transmissions;
+    if (transmissions > 0) sample.collision_rate = (double)(counters.collisions - last.counters.collisions) / transmissions;
+    sampler.previous = sample;
+    // Stay on the interval grid even if the process woke up late.
+    sampler.next_ms = (now_ms / sampler.interval_ms + 1) * sampler.interval_ms;
+    if (sampler.live) {
+        write_sample(sampler, sample);
+    } else if (sampler.ring.size() < SAMPLE_RING_SIZE) {
+        sampler.ring.push_back(sample);
+    } else {
+        sampler.ring[sampler.first] = sample;
+        sampler.first = (sampler.first + 1) % SAMPLE_RING_SIZE;
+        sampler.dropped++;
+    }
+}
+
+// Writes the samples kept in the ring, oldest first, and closes the output.
+inline void close_sampler(Sampler& sampler) {
+    if (!sampler.out) return;
+    for (size_t i = 0; i < sampler.ring.size(); i++) {
+        write_sample(sampler, sampler.ring[(sampler.first + i) % sampler.ring.size()]);
+    }
+    fclose(sampler.out);
+    sampler.out = nullptr;
+}
+
+#endif
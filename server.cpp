@@ -1,11 +1,20 @@
 // server.cpp
 #include "protocol.h"
+#include "checkpoint.h"
+#include "timer_wheel.h"
+#include "traffic.h"
+#include "shm_stats.h"
+#include "accounting.h"
+#include "sampler.h"
+#include "json_writer.h"
+#include "fec.h"
 #include <iostream>
 #include <fstream>
 #include <vector>
 #include <chrono>
-#include <thread>
 #include <random>
+#include <string>
+#include <deque>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
@@ -17,16 +26,124 @@ using namespace std;
 
 #define MAX_ATTEMPTS 10
 
+// Most generated frames a stripe keeps waiting; older ones are dropped beyond that.
+#define MAX_BACKLOG 64
+
+// Lower bound of the adaptive retransmission timeout, in microseconds (one timer tick).
+#define MIN_RTO_US 1000
+
+// Contention parameters of a traffic class.
+struct ClassParams {
+    const char* name;
+    int max_backoff_exp;    // backoff is drawn from [0, 2^min(attempts, max_backoff_exp) - 1] slots
+};
+
+// Contention parameters of each traffic class: latency-sensitive frames
+// keep their backoff windows short instead of growing them like bulk ones.
+const ClassParams class_params[NUM_CLASSES] = {
+    {"bulk", 10},
+    {"control", 3},
+};
+
+// Options that may follow the positional arguments on the command line.
+struct ServerOptions {
+    int stripes = 1;                    // number of concurrent connections the file is striped over
+    const char* checkpoint = nullptr;   // path of the progress log, or null for none
+    bool resume = false;                // skip the frames the progress log lists as acked
+    int retry_budget = 0;               // transmissions allowed for retrying parked frames (0: abort instead)
+    int traffic_class = CLASS_BULK;     // class of all the frames of this transfer
+    int max_backoff_exp = -1;           // overrides the class's backoff cap when not negative
+    int subchannels = 1;                // number of sub-channels the channel exposes
+    bool hop = false;                   // move to a less loaded sub-channel after a failed attempt
+    bool adaptive_rto = false;          // estimate the ACK timeout from the observed ACK latency
+    bool has_dest_id = false;           // send every frame to `dest_id` instead of a random one
+    uint8_t dest_id[6] = {};
+    TrafficOptions traffic;             // how frames are generated over time
+    const char* shm = nullptr;          // name of the shared-memory stats segment, or null for none
+    const char* samples = nullptr;      // file the time series of samples is written to, or null for none
+    bool samples_json = false;          // write the samples as JSON lines instead of CSV
+    bool samples_live = false;          // write every sample when it is taken instead of at exit
+    int sample_interval = 100;          // time between two samples, in milliseconds
+    const char* json = nullptr;         // file the report is written to as JSON ("-" for stdout), or null for none
+    int burst = 1;                      // frames sent per acquisition of the medium (TXOP), as allowed by the channel
+    uint32_t burst_bytes = 0;           // payload bytes a TXOP may start frames within; 0 means unlimited
+    bool tree = false;                  // tree splitting: transmit when the channel's slot feedback says so
+    int fec_k = 0;                      // data frames per block protected by repair frames (0: no FEC)
+    int fec_r = 0;                      // repair frames sent for each block
+};
+
+// Statistics about the frames sent over one connection.
+struct SendStats {
+    int total_transmissions = 0;
+    int max_trans_per_frame = 0;
+    int frames_parked = 0;
+    int frames_recovered = 0;
+    int retransmissions_from_queue = 0;
+    int subchannel_hops = 0;
+    int ack_timeouts = 0;
+    double srtt_us = 0;                 // final smoothed ACK latency (adaptive RTO only)
+    int frames_dropped = 0;             // generated frames dropped on a full backlog
+    double total_delay_ms = 0;          // sum over acked generated frames of the time from arrival to ACK
+    int collisions = 0;                 // noise heard on the sub-channel while waiting for an ACK
+    int burst_frames = 0;               // frames sent right after an ACK, within a burst
+    int deferrals = 0;                  // frames the channel deferred for another sender's burst
+    int tree_splits = 0;                // collisions after which the stripe split from the others (tree splitting)
+    int fec_repairs = 0;                // repair frames sent (FEC only), retransmissions excluded
+    int fec_erased = 0;                 // data frames left to the repair frames after an ACK timeout or too many collisions
+    int fec_recoverable = 0;            // lost frames a receiver that heard the rest of their block can decode
+    int fec_unrecovered = 0;            // lost frames it cannot
+    ByteAccounting account;             // bytes sent and received, and time spent in each phase
+    bool success = true;
+};
+
+// What a stripe has observed about the load of each sub-channel.
+struct SubchannelSense {
+    int current = 0;                    // the sub-channel frames are sent on
+    vector<double> collision_rate;      // moving average of the share of noise heard on each sub-channel
+    int hops = 0;
+};
+
+// Weight of each new observation in the collision rate averages.
+#define SENSE_ALPHA 0.1
+
+// Progress shared by all the stripes of a single transfer.
+// The stripes all run on the transfer's event loop, so they update it in turn.
+struct CompletionTracker {
+    size_t frames_acked = 0;
+    bool failed = false;
+    int retry_budget = 0;               // retry transmissions neither used nor reserved by a stripe
+    int retries_reserved = 0;           // retry transmissions reserved by the stripes retrying a frame
+    vector<uint8_t> done;
+    Checkpoint checkpoint;
+};
+
+// Source ID of this process: the process ID, unless --source-id was given.
+uint8_t base_source_id[6] = {
+    (uint8_t)(getpid() & 0xFF),
+    (uint8_t)((getpid() >> 8) & 0xFF),
+    (uint8_t)((getpid() >> 16) & 0xFF),
+    (uint8_t)((getpid() >> 24) & 0xFF),
+    0,
+    0,
+};
+
+// Sets the source ID of a frame before sending it.
+// The ID is the process's source ID, with the index of the stripe sending it
+// mixed into byte 4.
+void set_source_id(Frame& frame, int stripe) {
+    memcpy(frame.header.source_id, base_source_id, 6);
+    frame.header.source_id[4] ^= stripe & 0xFF;
+}
+
 // Sets the source and destiantion IDs of a frame before sending it.
-void set_source_dest_id(Frame& frame) {
+void set_source_dest_id(Frame& frame, const ServerOptions& options) {
     // Set the sender ID in the frame header to the process ID
-    frame.header.source_id[0] = getpid() & 0xFF;
-    frame.header.source_id[1] = (getpid() >> 8) & 0xFF;
-    frame.header.source_id[2] = (getpid() >> 16) & 0xFF;
-    frame.header.source_id[3] = (getpid() >> 24) & 0xFF;
-    frame.header.source_id[4] = 0;
-    frame.header.source_id[5] = 0;
-    // Set the destination ID in the frame header to the receiver's address randomly
+    set_source_id(frame, 0);
+    // Set the destination ID in the frame header to the given one, or to the receiver's address randomly
+    if (options.has_dest_id) {
+        memcpy(frame.header.dest_id, options.dest_id, 6);
+        return;
+    }
     frame.header.dest_id[0] = rand() % 256;
     frame.header.dest_id[1] = rand() % 256;
     frame.header.dest_id[2] = rand() % 256;
@@ -35,12 +152,29 @@ void set_source_dest_id(Frame& frame) {
     frame.header.dest_id[5] = 0;
 }
 
-// Checks if the source ID in the frame header matches the current process ID.
-bool is_my_source_id(const Frame& frame) {
-    return frame.header.source_id[0] == (getpid() & 0xFF) &&
-           frame.header.source_id[1] == ((getpid() >> 8) & 0xFF) &&
-           frame.header.source_id[2] == ((getpid() >> 16) & 0xFF) &&
-           frame.header.source_id[3] == ((getpid() >> 24) & 0xFF);
+// Checks if the source ID in the frame header matches the current process
+// and the given stripe.
+bool is_my_source_id(const Frame& frame, int stripe) {
+    Frame mine;
+    set_source_id(mine, stripe);
+    return memcmp(frame.header.source_id, mine.header.source_id, 6) == 0;
+}
+
+// Gets an identifier written as 12 hex digits, optionally separated by ':'.
+// Parses it into `id`.
+// Returns true on success, or false otherwise.
+bool parse_id(const string& text, uint8_t id[6]) {
+    string digits;
+    for (char c : text) {
+        if (c == ':') continue;
+        if (!isxdigit((unsigned char)c)) return false;
+        digits += c;
+    }
+    if (digits.size() != 12) return false;
+    for (int i = 0; i < 6; i++) {
+        id[i] = (uint8_t)stoi(digits.substr(2 * i, 2), nullptr, 16);
+    }
+    return true;
 }
 
 // Gets the IP address and port of the channel.
@@ -57,39 +191,12 @@ int connect_to_channel(const char* ip, int port) {
     return sock;
 }
 
-// Gets the channel's socket and a timeout.
-// Tries to receive a frame from the channel, giving up after the timeout.
-// On success, stores the frame in `output`.
-// Returns true on success, or false otherwise.
-bool receive_frame(int channel_fd, timeval &timeout, Frame &output) {
-    fd_set fds;
-    FD_ZERO(&fds);
-    FD_SET(channel_fd, &fds);
-    int ret = select(channel_fd + 1, &fds, nullptr, nullptr, &timeout);
-    if (ret <= 0) return false;
-    recv(channel_fd, &output, sizeof output, 0);
-    return true;
-}
-
-// Waits `time_ms` miliseconds.
-// Meanwhile, if any frames arive via the channel (in `channel_fd`),
-// this function receives and ignores them.
-void wait_and_drop_frames(int time_ms, int channel_fd) {
-#ifdef DEBUG
-    cout << "wait_and_drop_frames(" << time_ms << ", " << channel_fd << ")" << endl;
-#endif
-    Frame ignored_frame;
-    timeval now, wait_until;
-    gettimeofday(&now, nullptr);
-    timeval wait_time{0, time_ms * 1000};
-    timeradd(&now, &wait_time, &wait_until);
-    for (; timercmp(&now, &wait_until, <); gettimeofday(&now, nullptr)) {
-        timeval remaining_time;
-        timersub(&wait_until, &now, &remaining_time);
-        receive_frame(channel_fd, remaining_time, ignored_frame);
-    }
-    timeval zero_time{0, 0};
-    while (receive_frame(channel_fd, zero_time, ignored_frame)) {}
+// Gets a frame heard from the channel.
+// Updates the collision rate of the sub-channel it was sent on.
+void observe_frame(SubchannelSense* sense, const Frame& frame) {
+    if (!sense || frame.header.subchannel >= sense->collision_rate.size()) return;
+    double& rate = sense->collision_rate[frame.header.subchannel];
+    rate = (1 - SENSE_ALPHA) * rate + SENSE_ALPHA * (is_noise_frame(frame) || is_defer_frame(frame) ? 1 : 0);
 }
 
 // Gets a file.
@@ -104,7 +211,7 @@ uint64_t get_file_size(ifstream &file) {
 // Gets a file.
 // Divides its content into a sequence of frames.
 // Stores those frames in a vector and returns it.
-vector<Frame> file_to_frames(ifstream &file, uint64_t file_size, uint32_t frame_size) {
+vector<Frame> file_to_frames(ifstream &file, uint64_t file_size, uint32_t frame_size, const ServerOptions& options) {
     vector<Frame> result;
     for (uint32_t i = 0;; i++) {
         Frame frame;
@@ -113,7 +220,7 @@ vector<Frame> file_to_frames(ifstream &file, uint64_t file_size, uint32_t frame_
             (uint64_t)frame_size,
             file_size - file.tellg()
         );
-        set_source_dest_id(frame);
+        set_source_dest_id(frame, options);
         if (frame.header.payload_length == 0) break;
         file.read(frame.payload, frame.header.payload_length);
         result.push_back(frame);
@@ -121,17 +228,843 @@ vector<Frame> file_to_frames(ifstream &file, uint64_t file_size, uint32_t frame_
     return result;
 }
 
+// Gets a file, the transfer parameters and a seed.
+// Generates frames according to `options.traffic`, filling their payloads
+// with the file's content over and over.
+// Stores the time each frame becomes ready, in milliseconds from the start,
+// in `arrival_ms`, and returns the frames.
+vector<Frame> generate_frames(ifstream &file, uint64_t file_size, uint32_t frame_size, int slot_time, int seed,
+                              const ServerOptions& options, vector<uint64_t>& arrival_ms) {
+    vector<char> content(file_size);
+    file.read(content.data(), file_size);
+    if (content.empty()) content.push_back(0);
+    default_random_engine rng(seed);
+    vector<double> arrivals = generate_arrivals(options.traffic, rng);
+    vector<Frame> result;
+    uint64_t offset = 0;
+    for (uint32_t i = 0; i < arrivals.size(); i++) {
+        Frame frame;
+        frame.header.seq_number = i;
+        frame.header.payload_length = generate_frame_size(options.traffic, frame_size, rng);
+        // Repair frames carry a header, the block's sequence numbers and the length besides the largest payload of their block.
+        if (options.fec_k > 0) frame.header.payload_length = min(frame.header.payload_length, (uint32_t)fec_max_data_size(options.fec_k));
+        set_source_dest_id(frame, options);
+        for (uint32_t b = 0; b < frame.header.payload_length; b++) {
+            frame.payload[b] = content[offset];
+            offset = (offset + 1) % content.size();
+        }
+        result.push_back(frame);
+        arrival_ms.push_back((uint64_t)(arrivals[i] * slot_time));
+    }
+    return result;
+}
+
+// Gets what a stripe has observed about the sub-channels.
+// Moves it to one of the least loaded sub-channels (any whose collision rate
+// is close to the minimum, so that stripes do not all herd onto the same one).
+void hop_subchannel(SubchannelSense& sense, default_random_engine& rng) {
+    double lowest = *min_element(sense.collision_rate.begin(), sense.collision_rate.end());
+    vector<int> candidates;
+    for (int s = 0; s < (int)sense.collision_rate.size(); s++) {
+        if (sense.collision_rate[s] <= lowest + 0.05) candidates.push_back(s);
+    }
+    int next = candidates[uniform_int_distribution<int>(0, candidates.size() - 1)(rng)];
+    if (next != sense.current) sense.hops++;
+    sense.current = next;
+}
+
+// Gets a frame index that was just ACKed.
+// Records it in the shared tracker and in the progress log.
+void mark_acked(CompletionTracker& tracker, vector<Frame>& frames, size_t i) {
+    tracker.done[i] = 1;
+    tracker.frames_acked++;
+    checkpoint_ack(tracker.checkpoint, frames[i].header.seq_number);
+}
+
+// Retransmission timeout estimator of a stripe (RFC 6298), in microseconds.
+struct RtoEstimator {
+    bool has_sample = false;
+    double srtt = 0;                    // smoothed ACK latency
+    double rttvar = 0;                  // smoothed mean deviation of the ACK latency
+    int64_t rto = 0;                    // current timeout
+};
+
+// Gets an estimator, a measured ACK latency and the largest allowed timeout.
+// Updates the smoothed latency and its deviation, and recomputes the timeout.
+void rto_sample(RtoEstimator& est, double rtt, int64_t max_rto) {
+    if (!est.has_sample) {
+        est.srtt = rtt;
+        est.rttvar = rtt / 2;
+        est.has_sample = true;
+    } else {
+        est.rttvar = 0.75 * est.rttvar + 0.25 * abs(est.srtt - rtt);
+        est.srtt = 0.875 * est.srtt + 0.125 * rtt;
+    }
+    est.rto = min(max_rto, max((int64_t)MIN_RTO_US, (int64_t)(est.srtt + max(1000.0, 4 * est.rttvar))));
+}
+
+// Doubles the timeout of an estimator after an ACK timeout, up to `max_rto`.
+void rto_backoff(RtoEstimator& est, int64_t max_rto) {
+    est.rto = min(max_rto, est.rto * 2);
+}
+
+// What a stripe is doing.
+enum StripeState {
+    STRIPE_WAIT_ACK,        // a frame was sent; waiting for its echo until the ACK timeout
+    STRIPE_BACKOFF,         // waiting before retransmitting the frame
+    STRIPE_POST_ACK,        // waiting one slot after an ACK before sending the next frame
+    STRIPE_IDLE,            // waiting for the next frame to be generated
+    STRIPE_CONTEND,         // tree splitting: waiting for the slot the collision resolution gives the frame
+    STRIPE_DONE,
+};
+
+// A block of data frames sent by a stripe and protected by repair frames (FEC only).
+struct FecBlock {
+    uint32_t number = 0;                // blocks the stripe sent before this one
+    vector<size_t> frames;              // the block's data frames, in the order they were sent
+    size_t shard_size = 0;              // length of the block's shards, set once it is full
+    vector<Frame> repairs;              // the block's repair frames, computed once it is full
+    int repairs_done = 0;               // repair frames sent, whether ACKed or not
+    vector<vector<uint8_t>> echoes;     // the shard of each data then repair frame as echoed by the channel, or empty
+};
+
+// One connection of a transfer, sending every `options.stripes`-th frame.
+struct Stripe {
+    int index;
+    int sock;
+    default_random_engine rng;          // for backoff and hopping
+    SubchannelSense sense;
+    int max_backoff_exp;                // backoff cap of the transfer's traffic class
+    StripeState state = STRIPE_DONE;
+    uint64_t generation = 0;            // bumped whenever a timer is set, so older timers are ignored
+    size_t next;                        // next frame of the first pass
+    deque<size_t> parked;               // frames that exhausted their attempts, to be retried later
+    size_t current = 0;                 // the frame being sent
+    bool retrying = false;              // the current frame came from `parked`
+    int attempts = 0;                   // transmissions of the current frame
+    int max_attempts = 0;               // transmissions allowed for the current frame
+    int64_t sent_at_us = 0;             // when the current frame was last transmitted
+    bool resent = false;                // the current frame was transmitted before its current attempts
+    int burst_left = 0;                 // frames the stripe may still send in its current burst
+    int64_t burst_bytes_left = 0;       // payload bytes the stripe may still start frames within (burst_bytes only)
+    FecBlock fec;                       // the block being sent (FEC only)
+    int repair = -1;                    // the repair frame of the block being sent, or -1 for a data frame
+    bool coded = false;                 // the frame being sent is part of `fec`, so the repair frames cover its loss
+    deque<size_t> erased;               // frames of the last block without an ACK, to be retransmitted
+    int tree_counter = -1;              // slots to let pass before transmitting in the current collision
+                                        // resolution interval, or -1 while waiting for the next one (tree splitting)
+    bool splitting = false;             // the current frame collided in the current interval (tree splitting)
+    int split_attempts = 0;             // transmissions of the current frame while splitting, not counted toward its limit
+    RtoEstimator rto;
+    SendStats stats;
+    StatSlot* stat = nullptr;           // row of this stripe in the shared-memory stats, if any
+};
+
+// A deadline of a stripe, tagged with the stripe's generation when it was set.
+struct StripeTimer {
+    int stripe;
+    uint64_t generation;
+};
+
+// Everything the event loop of one transfer works on.
+struct Transfer {
+    vector<Frame>& frames;
+    const vector<uint64_t>& arrival_ms; // when each generated frame becomes ready; empty when sending a file
+    const ServerOptions& options;
+    int slot_time;
+    int64_t timeout_us;                 // ACK timeout, or the largest one with an adaptive timeout
+    CompletionTracker& tracker;
+    vector<Stripe> stripes;
+    TimerWheel<StripeTimer> timers;     // the deadline of every stripe, in milliseconds since `start`
+    Sampler sampler;                    // time series of the transfer's progress, if sampling
+    vector<uint8_t> transmitted;        // whether each frame was ever transmitted
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+};
+
+// Returns the time passed since the transfer started, in milliseconds.
+uint64_t elapsed_ms(const Transfer& transfer) {
+    return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - transfer.start).count();
+}
+
+// Returns the time passed since the transfer started, in microseconds.
+int64_t elapsed_us(const Transfer& transfer) {
+    return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - transfer.start).count();
+}
+
+// Gets the state of a stripe.
+// Returns the phase its time is accounted to.
+SendPhase phase_of(StripeState state) {
+    switch (state) {
+    case STRIPE_WAIT_ACK: return PHASE_WAIT_ACK;
+    case STRIPE_BACKOFF:
+    case STRIPE_CONTEND: return PHASE_BACKOFF;
+    case STRIPE_POST_ACK: return PHASE_POST_ACK;
+    case STRIPE_IDLE: return PHASE_IDLE;
+    default: return PHASE_DONE;
+    }
+}
+
+// Gets a stripe and a state.
+// Moves the stripe to that state, accounting the time spent in the previous one.
+void set_state(Transfer& transfer, Stripe& stripe, StripeState state) {
+    stripe.state = state;
+    account_phase(stripe.stats.account, phase_of(state), elapsed_us(transfer));
+}
+
+// Gets a stripe and a state.
+// Moves the stripe to that state until `delay_ms` milliseconds from now.
+void set_timer(Transfer& transfer, Stripe& stripe, StripeState state, int delay_ms) {
+    set_state(transfer, stripe, state);
+    stripe.generation++;
+    wheel_schedule(transfer.timers, elapsed_ms(transfer) + delay_ms, StripeTimer{stripe.index, stripe.generation});
+}
+
+// Returns the frame the stripe is sending: a repair frame of its block, or its current frame.
+Frame& sending_frame(Transfer& transfer, Stripe& stripe) {
+    return stripe.repair >= 0 ? stripe.fec.repairs[stripe.repair] : transfer.frames[stripe.current];
+}
+
+// Sends the stripe's current frame, and waits for its ACK.
+void transmit(Transfer& transfer, Stripe& stripe) {
+    Frame& frame = sending_frame(transfer, stripe);
+    set_source_id(frame, stripe.index);
+    frame.header.traffic_class = transfer.options.traffic_class;
+    frame.header.subchannel = stripe.sense.current;
+    account_phase(stripe.stats.account, PHASE_SENDING, elapsed_us(transfer));
+    if (send(stripe.sock, &frame, frame_wire_size(frame), 0) > 0) {
+        account_sent(stripe.stats.account, frame_wire_size(frame));
+    }
+    if (stripe.attempts == 0) {
+        // Each repair frame is only sent in its own attempts.
+        stripe.resent = stripe.repair < 0 && transfer.transmitted[stripe.current];
+        if (stripe.repair < 0) transfer.transmitted[stripe.current] = 1;
+    }
+    stripe.attempts++;
+    stripe.sent_at_us = elapsed_us(transfer);
+    // Timers tick in milliseconds, so round the timeout up.
+    int64_t timeout_us = transfer.options.adaptive_rto ? stripe.rto.rto : transfer.timeout_us;
+    set_timer(transfer, stripe, STRIPE_WAIT_ACK, (int)((timeout_us + 999) / 1000));
+}
+
+// Waits for the channel's feedback on the next slot (tree splitting only).
+// If its turn does not come closer within the ACK timeout, the stripe transmits anyway.
+void wait_for_turn(Transfer& transfer, Stripe& stripe) {
+    set_timer(transfer, stripe, STRIPE_CONTEND, (int)((transfer.timeout_us + 999) / 1000));
+}
+
+// Gets a stripe with a frame to send.
+// Sends it right away, or with tree splitting waits for the collision
+// resolution interval in progress to end, after which the channel's feedback
+// tells the stripe when to transmit.
+void contend(Transfer& transfer, Stripe& stripe) {
+    if (!transfer.options.tree) {
+        transmit(transfer, stripe);
+        return;
+    }
+    stripe.tree_counter = -1;
+    stripe.splitting = false;
+    wait_for_turn(transfer, stripe);
+}
+
+// Returns true if the stripe's current frame may be transmitted again. With
+// tree splitting, its retransmissions while the stripe splits from the
+// senders it collided with are not counted: each split only resolves the
+// collision, and a crowded interval would otherwise use up the attempts.
+bool attempts_left(const Stripe& stripe) {
+    return stripe.attempts - stripe.split_attempts < stripe.max_attempts;
+}
+
+// Gets a stripe whose turn to transmit came (tree splitting only).
+// Transmits its frame, unless the frame already used all its attempts, in
+// which case it is given up on right away, as at the end of a backoff.
+void transmit_in_turn(Transfer& transfer, Stripe& stripe) {
+    if (stripe.splitting) {
+        stripe.split_attempts++;
+        transmit(transfer, stripe);
+    } else if (attempts_left(stripe)) {
+        transmit(transfer, stripe);
+    } else {
+        set_timer(transfer, stripe, STRIPE_BACKOFF, 0);
+    }
+}
+
+// Gets the channel's feedback on the slot that just ended on the stripe's
+// sub-channel (tree splitting only).
+// Runs the stack algorithm of tree splitting: after a collision, the stripes
+// that collided split at random between retransmitting in the next slot and
+// waiting one more, and the stripes already waiting wait one slot more; after
+// an idle or successful slot, they wait one slot less. When the channel says
+// the group whose turn is next would surely collide, that group splits right
+// away instead. Stripes with a new frame join once the collision resolution
+// interval is over. The stripe only waits for its turn anew (restarting the
+// fallback timeout) when it comes one slot closer or farther.
+void slot_feedback(Transfer& transfer, Stripe& stripe, const SlotFeedback& feedback) {
+    bool collision = feedback.outcome == SLOT_COLLISION;
+    int counter = stripe.tree_counter;
+    if (stripe.state == STRIPE_WAIT_ACK && stripe.tree_counter == 0) {
+        // The stripe transmitted in that slot; a success comes with its ACK.
+        if (!collision) return;
+        stripe.stats.tree_splits++;
+        stripe.splitting = true;
+        stripe.tree_counter = uniform_int_distribution<int>(0, 1)(stripe.rng);
+        // Leaving WAIT_ACK always needs a new timer.
+        counter = -1;
+    } else if (stripe.state == STRIPE_CONTEND) {
+        if (stripe.tree_counter < 0) {
+            if (feedback.depth == 0) stripe.tree_counter = 0;
+        } else if (feedback.split) {
+            if (stripe.tree_counter == 1) {
+                stripe.stats.tree_splits++;
+                stripe.tree_counter = uniform_int_distribution<int>(0, 1)(stripe.rng);
+            }
+        } else {
+            stripe.tree_counter += collision ? 1 : -1;
+        }
+    } else {
+        return;
+    }
+    if (stripe.tree_counter != 0) {
+        if (stripe.tree_counter != counter) wait_for_turn(transfer, stripe);
+        return;
+    }
+    transmit_in_turn(transfer, stripe);
+}
+
+// Stops every stripe of the transfer, after one of them failed.
+void fail_transfer(Transfer& transfer, Stripe& stripe) {
+    stripe.stats.success = false;
+    transfer.tracker.failed = true;
+    for (auto& other : transfer.stripes) set_state(transfer, other, STRIPE_DONE);
+}
+
+// Checks if the stripe's next frame was generated, but more than MAX_BACKLOG
+// of the stripe's frames are waiting with it, so it should be dropped.
+bool backlog_full(Transfer& transfer, Stripe& stripe, uint64_t now) {
+    size_t newest = stripe.next + (size_t)transfer.options.stripes * MAX_BACKLOG;
+    return newest < transfer.frames.size() && transfer.arrival_ms[newest] <= now;
+}
+
+// Gets frame `i` of the stripe, which reached the channel.
+// Records its goodput, its delay (generated traffic only) and its ACK.
+void record_delivery(Transfer& transfer, Stripe& stripe, size_t i) {
+    account_acked(stripe.stats.account, transfer.frames[i].header.payload_length);
+    if (!transfer.arrival_ms.empty()) {
+        stripe.stats.total_delay_ms += elapsed_ms(transfer) - transfer.arrival_ms[i];
+    }
+    mark_acked(transfer.tracker, transfer.frames, i);
+}
+
+// Computes the repair frames of the stripe's block once it is full (FEC only).
+void encode_block(Transfer& transfer, Stripe& stripe) {
+    FecBlock& block = stripe.fec;
+    uint32_t longest = 0;
+    for (size_t i : block.frames) longest = max(longest, transfer.frames[i].header.payload_length);
+    block.shard_size = FEC_LENGTH_SIZE + longest;
+    vector<vector<uint8_t>> shards;
+    for (size_t i : block.frames) shards.push_back(fec_shard(transfer.frames[i], block.shard_size));
+    vector<const uint8_t*> data;
+    for (auto& shard : shards) data.push_back(shard.data());
+    vector<vector<uint8_t>> parity;
+    fec_encode(data, block.shard_size, transfer.options.fec_r, parity);
+    FecHeader header{block.number, (uint8_t)block.frames.size(), (uint8_t)transfer.options.fec_r, 0, 0};
+    vector<uint32_t> seqs;
+    for (size_t i : block.frames) seqs.push_back(transfer.frames[i].header.seq_number);
+    for (int j = 0; j < transfer.options.fec_r; j++) {
+        Frame repair = transfer.frames[block.frames[0]];
+        header.index = j;
+        create_repair_frame(repair, header, seqs, parity[j]);
+        block.repairs.push_back(repair);
+    }
+}
+
+// Gets a frame the stripe sent as part of its block, and its echo (FEC only).
+// Keeps the shard the echo carries, as the receivers' copy of the frame.
+void keep_echo(Stripe& stripe, const Frame& echo) {
+    FecBlock& block = stripe.fec;
+    // A data frame is always the last one added to the block when it is sent.
+    size_t index = stripe.repair >= 0 ? block.frames.size() + stripe.repair : block.frames.size() - 1;
+    if (block.echoes.size() <= index) block.echoes.resize(index + 1);
+    if (stripe.repair >= 0) {
+        size_t overhead = fec_repair_overhead(block.frames.size());
+        if (echo.header.payload_length != overhead + block.shard_size) return;
+        const uint8_t* shard = (const uint8_t*)echo.payload + overhead;
+        block.echoes[index].assign(shard, shard + block.shard_size);
+    } else {
+        block.echoes[index] = fec_shard(echo, FEC_LENGTH_SIZE + echo.header.payload_length);
+    }
+}
+
+// Decodes the stripe's block once its repair frames were sent (FEC only).
+// Every frame of the block whose echo never came is reconstructed from the
+// echoes of the others and of the repair frames, and checked against the
+// frame that was sent, to count the lost frames a receiver that heard what
+// the stripe heard can rebuild. Only the receivers know whether they did, so
+// every such frame is retransmitted all the same, and counted as delivered
+// once acked. Starts the next block.
+void decode_block(Transfer& transfer, Stripe& stripe) {
+    FecBlock& block = stripe.fec;
+    int k = block.frames.size();
+    vector<int> missing;
+    for (int i = 0; i < k; i++) {
+        if (!transfer.tracker.done[block.frames[i]]) missing.push_back(i);
+    }
+    if (!missing.empty()) {
+        vector<int> indices;
+        vector<const uint8_t*> shards;
+        for (size_t s = 0; s < block.echoes.size() && (int)indices.size() < k; s++) {
+            vector<uint8_t>& echo = block.echoes[s];
+            if (echo.empty() || echo.size() > block.shard_size) continue;
+            echo.resize(block.shard_size, 0);
+            indices.push_back(s);
+            shards.push_back(echo.data());
+        }
+        vector<vector<uint8_t>> data;
+        bool decoded = fec_decode(k, indices, shards, block.shard_size, data);
+        for (int i : missing) {
+            size_t frame = block.frames[i];
+            if (decoded && data[i] == fec_shard(transfer.frames[frame], block.shard_size)) {
+                stripe.stats.fec_recoverable++;
+            } else {
+                stripe.stats.fec_unrecovered++;
+            }
+            stripe.erased.push_back(frame);
+        }
+    }
+    uint32_t number = block.number + 1;
+    block = FecBlock();
+    block.number = number;
+}
+
+// Picks the next frame of a stripe that protects its frames with repair
+// frames (FEC only): the next repair frame once its block is full (or the
+// stripe has no new frames left), then the frames of the block left without
+// an ACK. Decodes the block after its last repair frame.
+// Returns true if it sent a frame, or false to go on with the stripe's new frames.
+bool next_fec_frame(Transfer& transfer, Stripe& stripe) {
+    FecBlock& block = stripe.fec;
+    bool full = block.frames.size() == (size_t)transfer.options.fec_k ||
+                (!block.frames.empty() && stripe.next >= transfer.frames.size());
+    if (full && block.repairs.empty()) encode_block(transfer, stripe);
+    if (full && block.repairs_done < (int)block.repairs.size()) {
+        stripe.repair = block.repairs_done;
+        stripe.coded = true;
+        stripe.retrying = false;
+        stripe.max_attempts = MAX_ATTEMPTS;
+        stripe.stats.fec_repairs++;
+        contend(transfer, stripe);
+        return true;
+    }
+    if (full) decode_block(transfer, stripe);
+    if (stripe.erased.empty()) return false;
+    stripe.current = stripe.erased.front();
+    stripe.erased.pop_front();
+    stripe.retrying = false;
+    stripe.max_attempts = MAX_ATTEMPTS;
+    contend(transfer, stripe);
+    return true;
+}
+
+// Picks the next frame of the stripe and sends it: first the stripe's frames
+// in order (skipping those acked in a previous run), then the parked frames
+// while the shared retry budget lasts. A stripe only reserves what is left of
+// the budget, and waits while other stripes hold all of it.
+// With FEC, every `fec_k` frames are followed by their block's repair frames.
+// Generated frames are sent once they are ready; until then the stripe idles.
+void start_next_frame(Transfer& transfer, Stripe& stripe) {
+    CompletionTracker& tracker = transfer.tracker;
+    while (stripe.next < transfer.frames.size() && tracker.done[stripe.next]) stripe.next += transfer.options.stripes;
+    stripe.attempts = 0;
+    stripe.split_attempts = 0;
+    stripe.repair = -1;
+    stripe.coded = false;
+    if (transfer.options.fec_k > 0 && next_fec_frame(transfer, stripe)) return;
+    if (!transfer.arrival_ms.empty()) {
+        uint64_t now = elapsed_ms(transfer);
+        while (stripe.next < transfer.frames.size() && backlog_full(transfer, stripe, now)) {
+            stripe.stats.frames_dropped++;
+            stripe.next += transfer.options.stripes;
+        }
+        if (stripe.next < transfer.frames.size() && transfer.arrival_ms[stripe.next] > now) {
+            set_timer(transfer, stripe, STRIPE_IDLE, (int)(transfer.arrival_ms[stripe.next] - now));
+            return;
+        }
+    }
+    if (stripe.next < transfer.frames.size()) {
+        stripe.current = stripe.next;
+        stripe.next += transfer.options.stripes;
+        stripe.retrying = false;
+        stripe.max_attempts = MAX_ATTEMPTS;
+        if (transfer.options.fec_k > 0) {
+            stripe.fec.frames.push_back(stripe.current);
+            stripe.coded = true;
+        }
+        contend(transfer, stripe);
+        return;
+    }
+    if (!stripe.parked.empty()) {
+        int reserved = min(MAX_ATTEMPTS, tracker.retry_budget);
+        if (reserved <= 0 && tracker.retries_reserved > 0) {
+            // Other stripes hold the rest of the budget: wait for what they leave unused.
+            set_timer(transfer, stripe, STRIPE_IDLE, transfer.slot_time);
+            return;
+        }
+        if (reserved <= 0) {
+            // The budget is spent: the stripe gives up, the others go on with their frames.
+            stripe.stats.success = false;
+            tracker.failed = true;
+            set_state(transfer, stripe, STRIPE_DONE);
+            return;
+        }
+        tracker.retry_budget -= reserved;
+        tracker.retries_reserved += reserved;
+        stripe.current = stripe.parked.front();
+        stripe.parked.pop_front();
+        stripe.retrying = true;
+        stripe.max_attempts = reserved;
+        contend(transfer, stripe);
+        return;
+    }
+    set_state(transfer, stripe, STRIPE_DONE);
+}
+
+// Updates the statistics of the stripe after its current frame was ACKed or
+// ran out of attempts.
+void count_transmissions(Transfer& transfer, Stripe& stripe) {
+    stripe.stats.total_transmissions += stripe.attempts;
+    stripe.stats.max_trans_per_frame = max(stripe.stats.max_trans_per_frame, stripe.attempts);
+    if (stripe.retrying) {
+        // Return the reserved transmissions the frame did not use.
+        transfer.tracker.retry_budget += stripe.max_attempts - (stripe.attempts - stripe.split_attempts);
+        transfer.tracker.retries_reserved -= stripe.max_attempts;
+        stripe.stats.retransmissions_from_queue += stripe.attempts;
+    }
+}
+
+// Gets a stripe whose frame was just ACKed (burst mode only).
+// Charges the frame to the stripe's burst, starting one if the frame
+// acquired the medium, and sends the next frame right away, without a
+// post-ACK slot, while the burst lasts (the channel keeps other senders
+// off the medium meanwhile).
+// Returns true if the stripe moved on, or false if the burst is over.
+bool continue_burst(Transfer& transfer, Stripe& stripe) {
+    const ServerOptions& options = transfer.options;
+    if (stripe.burst_left > 0) {
+        stripe.burst_left--;
+    } else {
+        stripe.burst_left = options.burst - 1;
+        stripe.burst_bytes_left = options.burst_bytes;
+    }
+    stripe.burst_bytes_left -= sending_frame(transfer, stripe).header.payload_length;
+    if (stripe.burst_left <= 0 || (options.burst_bytes > 0 && stripe.burst_bytes_left <= 0)) {
+        stripe.burst_left = 0;
+        return false;
+    }
+    start_next_frame(transfer, stripe);
+    // A frame that is not ready yet will have to contend again.
+    if (stripe.state == STRIPE_WAIT_ACK) {
+        stripe.stats.burst_frames++;
+    } else {
+        stripe.burst_left = 0;
+    }
+    return true;
+}
+
+// Handles the ACK (`echo`) of the stripe's current frame: records it, then
+// waits `slot_time` before moving on to the next frame (or goes on with its burst).
+void frame_acked(Transfer& transfer, Stripe& stripe, const Frame& echo) {
+#ifdef DEBUG
+    cout << "Acked: 1" << endl;
+#endif
+    // Karn's rule: only frames ACKed on their first transmission give an
+    // unambiguous latency, so parked, erased and repeated frames are not sampled.
+    if (transfer.options.adaptive_rto && stripe.attempts == 1 && !stripe.retrying && !stripe.resent) {
+        rto_sample(stripe.rto, elapsed_us(transfer) - stripe.sent_at_us, transfer.timeout_us);
+    }
+    count_transmissions(transfer, stripe);
+    // A re-ACK carries no payload to decode the block with.
+    if (stripe.coded && !is_reack_frame(echo)) keep_echo(stripe, echo);
+    if (stripe.repair >= 0) {
+        stripe.fec.repairs_done++;
+    } else {
+        if (stripe.retrying) stripe.stats.frames_recovered++;
+        record_delivery(transfer, stripe, stripe.current);
+    }
+    if (transfer.options.burst > 1 && continue_burst(transfer, stripe)) return;
+    // With tree splitting, the next frame waits for the slot feedback instead.
+    if (transfer.options.tree) {
+        start_next_frame(transfer, stripe);
+        return;
+    }
+    set_timer(transfer, stripe, STRIPE_POST_ACK, transfer.slot_time);
+}
+
+// Handles a frame of the stripe's block that is given up on, after an ACK
+// timeout or too many collisions (FEC only): instead of being retransmitted
+// at once, it waits for the block's repair frames, which may let the
+// receivers rebuild it first.
+void leave_to_repairs(Transfer& transfer, Stripe& stripe) {
+    stripe.burst_left = 0;
+    count_transmissions(transfer, stripe);
+    if (stripe.repair >= 0) {
+        stripe.fec.repairs_done++;
+    } else {
+        stripe.stats.fec_erased++;
+    }
+}
+
+// Handles a failed attempt (noise or ACK timeout): backs off for a random
+// number of slots before retrying. With tree splitting, the frame contends
+// again right away instead.
+void attempt_failed(Transfer& transfer, Stripe& stripe) {
+    stripe.burst_left = 0;
+    uniform_int_distribution<int> backoff_dist(0, (1 << min(stripe.attempts, stripe.max_backoff_exp)) - 1);
+    int slots = transfer.options.tree ? 0 : backoff_dist(stripe.rng);
+    set_timer(transfer, stripe, STRIPE_BACKOFF, slots * transfer.slot_time);
+}
+
+// Gets a stripe whose frame the channel deferred, because another sender
+// holds the sub-channel for a burst of up to `slots` slots (burst mode only).
+// Waits that long, then sends the frame again: deferring is not a failed
+// attempt, so it neither uses up the frame's attempts nor grows its backoff.
+void frame_deferred(Transfer& transfer, Stripe& stripe, uint32_t slots) {
+    stripe.burst_left = 0;
+    stripe.attempts--;
+    stripe.stats.deferrals++;
+    set_timer(transfer, stripe, STRIPE_BACKOFF, slots * transfer.slot_time);
+}
+
+// Handles the end of a backoff: retransmits the frame, or gives up on it
+// once it used all its attempts.
+// A frame given up on is parked if there is a retry budget; otherwise the
+// whole transfer fails.
+void backoff_over(Transfer& transfer, Stripe& stripe) {
+    if (transfer.options.hop) hop_subchannel(stripe.sense, stripe.rng);
+    if (attempts_left(stripe)) {
+        contend(transfer, stripe);
+        return;
+    }
+#ifdef DEBUG
+    cout << "Acked: 0" << endl;
+#endif
+    if (stripe.coded) {
+        leave_to_repairs(transfer, stripe);
+        start_next_frame(transfer, stripe);
+        return;
+    }
+    count_transmissions(transfer, stripe);
+    if (stripe.retrying) {
+        stripe.parked.push_back(stripe.current);
+    } else if (transfer.options.retry_budget > 0) {
+        // Park the frame and move on to the next one.
+        stripe.parked.push_back(stripe.current);
+        stripe.stats.frames_parked++;
+    } else {
+        fail_transfer(transfer, stripe);
+        return;
+    }
+    start_next_frame(transfer, stripe);
+}
+
+// Gets a frame the stripe received from the channel.
+// Treats it as the ACK of the current frame if it is its echo, or as a
+// collision if it is noise on the stripe's sub-channel; ignores it otherwise.
+void frame_received(Transfer& transfer, Stripe& stripe, const Frame& frame) {
+    ByteAccounting& account = stripe.stats.account;
+    if (is_feedback_frame(frame)) {
+        bool mine = transfer.options.tree && frame.header.subchannel == stripe.sense.current;
+        account_received(account, frame_wire_size(frame), mine);
+        if (!mine) return;
+        SlotFeedback feedback;
+        memcpy(&feedback, frame.payload, sizeof(SlotFeedback));
+        slot_feedback(transfer, stripe, feedback);
+        return;
+    }
+    observe_frame(&stripe.sense, frame);
+    if (stripe.state != STRIPE_WAIT_ACK) {
+        account_received(account, frame_wire_size(frame), false);
+        return;
+    }
+    const Frame& sent = sending_frame(transfer, stripe);
+    if (is_defer_frame(frame)) {
+        bool mine = frame.header.subchannel == sent.header.subchannel;
+        account_received(account, frame_wire_size(frame), mine);
+        if (mine) frame_deferred(transfer, stripe, defer_slots(frame));
+        return;
+    }
+    if (is_noise_frame(frame)) {
+        bool mine = frame.header.subchannel == sent.header.subchannel;
+        account_received(account, frame_wire_size(frame), mine);
+        if (mine) {
+            stripe.stats.collisions++;
+            // With tree splitting, the slot's feedback tells the stripe what to do next.
+            if (!transfer.options.tree) attempt_failed(transfer, stripe);
+        }
+        return;
+    }
+    bool ack = frame.header.seq_number == sent.header.seq_number && is_my_source_id(frame, stripe.index) &&
+               is_repair_frame(frame) == is_repair_frame(sent) &&
+               (!is_repair_frame(sent) || fec_repair_index(frame) == stripe.repair);
+    account_received(account, frame_wire_size(frame), ack);
+    if (ack) frame_acked(transfer, stripe, frame);
+}
+
+// Handles an expired deadline of the stripe.
+void timer_expired(Transfer& transfer, Stripe& stripe) {
+    switch (stripe.state) {
+    case STRIPE_WAIT_ACK:
+        stripe.stats.ack_timeouts++;
+        if (transfer.options.adaptive_rto) rto_backoff(stripe.rto, transfer.timeout_us);
+        // The frame may be lost rather than collided: repair frames cover a lost frame of the block.
+        if (stripe.coded) {
+            leave_to_repairs(transfer, stripe);
+            set_timer(transfer, stripe, STRIPE_POST_ACK, transfer.slot_time);
+        } else {
+            attempt_failed(transfer, stripe);
+        }
+        break;
+    case STRIPE_BACKOFF:
+        backoff_over(transfer, stripe);
+        break;
+    case STRIPE_POST_ACK:
+    case STRIPE_IDLE:
+        start_next_frame(transfer, stripe);
+        break;
+    case STRIPE_CONTEND:
+        // No feedback came (the channel does not run tree splitting, or it was
+        // lost), or the interval is stuck: transmit outside of it, as a counted attempt.
+        stripe.tree_counter = 0;
+        stripe.splitting = false;
+        transmit_in_turn(transfer, stripe);
+        break;
+    case STRIPE_DONE:
+        break;
+    }
+}
+
+// Publishes the statistics of every stripe to the shared-memory stats.
+void publish_stripe_stats(const Transfer& transfer) {
+    for (auto& stripe : transfer.stripes) {
+        if (!stripe.stat) continue;
+        StatValues values;
+        values.frames = stripe.stats.account.goodput_frames;
+        values.bytes = stripe.stats.account.goodput_bytes;
+        values.collisions = stripe.stats.collisions;
+        // Count the attempts at the current frame too, so the rate does not lag behind.
+        values.transmissions = stripe.stats.total_transmissions + (stripe.state == STRIPE_DONE ? 0 : stripe.attempts);
+        values.ack_timeouts = stripe.stats.ack_timeouts;
+        values.drops = stripe.stats.frames_dropped;
+        publish_stats(stripe.stat, values);
+    }
+}
+
+// Takes a sample of the transfer's progress if one is due.
+void sample_transfer(Transfer& transfer) {
+    uint64_t now = elapsed_ms(transfer);
+    if (!sample_due(transfer.sampler, now)) return;
+    SampleCounters counters;
+    for (auto& stripe : transfer.stripes) {
+        counters.frames += stripe.stats.account.goodput_frames;
+        counters.bytes += stripe.stats.account.goodput_bytes;
+        counters.collisions += stripe.stats.collisions;
+        counters.transmissions += stripe.stats.account.wire_frames;
+        if (stripe.state == STRIPE_WAIT_ACK) counters.in_flight++;
+        if (stripe.state == STRIPE_BACKOFF || stripe.state == STRIPE_CONTEND) counters.backing_off++;
+        if (stripe.state != STRIPE_DONE) counters.active++;
+    }
+    take_sample(transfer.sampler, now, counters);
+}
+
+// Gets a transfer whose stripes are connected to the channel.
+// Runs all the stripes from a single event loop until each one is done:
+// frames from the channel are handled as they arrive, and the deadlines of
+// the stripes (ACK timeouts, backoffs, post-ACK slots) are kept in a timer
+// wheel checked every millisecond.
+void run_transfer(Transfer& transfer) {
+    for (auto& stripe : transfer.stripes) start_next_frame(transfer, stripe);
+
+    while (true) {
+        fd_set fds;
+        FD_ZERO(&fds);
+        int maxfd = -1;
+        for (auto& stripe : transfer.stripes) {
+            if (stripe.state == STRIPE_DONE) continue;
+            FD_SET(stripe.sock, &fds);
+            maxfd = max(maxfd, stripe.sock);
+        }
+        if (maxfd < 0) break;
+
+        // Sleep until the earliest deadline (or sample), unless a frame arrives first.
+        int64_t wake_us = transfer.timers.count > 0 ? (int64_t)wheel_next_due(transfer.timers) * 1000 : INT64_MAX;
+        if (transfer.sampler.out) wake_us = min(wake_us, (int64_t)transfer.sampler.next_ms * 1000);
+        int64_t wait_us = wake_us == INT64_MAX ? 1000000 : max(wake_us - elapsed_us(transfer), (int64_t)0);
+        timeval tv{(time_t)(wait_us / 1000000), (suseconds_t)(wait_us % 1000000)};
+        if (select(maxfd + 1, &fds, nullptr, nullptr, &tv) > 0) {
+            for (auto& stripe : transfer.stripes) {
+                if (stripe.state == STRIPE_DONE || !FD_ISSET(stripe.sock, &fds)) continue;
+                Frame frame;
+                if (recv_frame(stripe.sock, frame) <= 0) {
+                    // The channel is gone.
+                    fail_transfer(transfer, stripe);
+                    break;
+                }
+                frame_received(transfer, stripe, frame);
+            }
+        }
+
+        vector<StripeTimer> expired;
+        wheel_expire(transfer.timers, elapsed_ms(transfer), expired);
+        for (auto& timer : expired) {
+            Stripe& stripe = transfer.stripes[timer.stripe];
+            if (timer.generation == stripe.generation) timer_expired(transfer, stripe);
+        }
+        publish_stripe_stats(transfer);
+        sample_transfer(transfer);
+    }
+    publish_stripe_stats(transfer);
+    // A last sample, so the time series ends with the final totals.
+    transfer.sampler.next_ms = 0;
+    sample_transfer(transfer);
+}
+
+// Gets the path of the JSON report ("-" for stdout) and an error.
+// Writes a report that only says the transfer could not run, and why.
+void write_json_error(const char* path, const string& error) {
+    ofstream json_file;
+    if (string(path) != "-") {
+        json_file.open(path);
+        if (!json_file) {
+            cerr << "Error: Cannot create JSON report " << path << endl;
+            return;
+        }
+    }
+    JsonWriter json{json_file.is_open() ? (ostream&)json_file : cout, {}};
+    json_begin_object(json);
+    json_value(json, "program", "server");
+    json_value(json, "success", false);
+    json_value(json, "error", error);
+    json_end_object(json);
+    json.out.flush();
+}
+
+// Gets the options and an error that stopped the transfer before it ran.
+// Prints it, and writes it as the JSON report if one was asked for.
+// Returns false, the result of the transfer.
+bool transfer_error(const ServerOptions& options, const string& error) {
+    cerr << "Error: " << error << endl;
+    if (options.json) write_json_error(options.json, error);
+    return false;
+}
+
 // Gets the arguments to the program (argv) after they have been parsed.
 // Reads the input file and splits it into frames.
-// Sends each frame to the channel using the Aloha-like protocol.
+// Sends the frames to the channel over `options.stripes` concurrent connections.
 // Prints statistics at the end.
-void send_file(const char* ip, int port, const char* filename, int frame_size, int slot_time, int seed, int timeout) {
+// Returns true if every frame was acked.
+bool send_file(const char* ip, int port, const char* filename, int frame_size, int slot_time, int seed, int64_t timeout_us,
+               const ServerOptions& options) {
     // Open file.
     ifstream file(filename, ios::binary);
-    if (!file) {
-        cerr << "Error: Cannot open file " << filename << endl;
-        return;
-    }
+    if (!file) return transfer_error(options, "Cannot open file " + string(filename));
 
     // Get file length.
     uint64_t file_size = get_file_size(file);
@@ -139,103 +1072,428 @@ void send_file(const char* ip, int port, const char* filename, int frame_size, i
     cout << "Length: " << file_size << endl;
 #endif
 
-    // Divide file content to frames and close the file.
-    vector<Frame> frames = file_to_frames(file, file_size, frame_size);
+    // Divide file content to frames (or generate frames from it) and close the file.
+    vector<uint64_t> arrival_ms;
+    vector<Frame> frames = options.traffic.model == TRAFFIC_FILE
+                               ? file_to_frames(file, file_size, frame_size, options)
+                               : generate_frames(file, file_size, frame_size, slot_time, seed, options, arrival_ms);
     file.close();
+    if (frames.empty()) return transfer_error(options, "No frames to send");
 #ifdef DEBUG
     for (auto& f : frames) {
         cout << "Payload length: " << f.header.payload_length << endl;
     }
 #endif 
 
-    // Connect to the channel.
-    int sock = connect_to_channel(ip, port);
-#ifdef DEBUG
-    cout << "connected" << endl;
-#endif
-
-    // Initialize random number generator (for backoff).
-    default_random_engine rng(seed);
+    // Load the frames acked in a previous run, and open the progress log.
+    CompletionTracker tracker;
+    tracker.retry_budget = options.retry_budget;
+    tracker.done.assign(frames.size(), 0);
+    size_t resumed = 0;
+    if (options.checkpoint) {
+        uint64_t file_hash = hash_frames(frames);
+        if (options.resume) {
+            resumed = load_checkpoint(options.checkpoint, file_hash, file_size, frame_size, tracker.done);
+        }
+        if (!open_checkpoint(tracker.checkpoint, options.checkpoint, resumed > 0, file_hash, file_size, frame_size)) {
+            return transfer_error(options, "Cannot open checkpoint " + string(options.checkpoint));
+        }
+    }
 
     // Record the time before the server starts sending.
     auto start = chrono::steady_clock::now();
 
-    // Statistics about sent frames.
-    int total_transmissions = 0;
-    int max_trans_per_frame = 0;
-
-    // true if all frames were sent successfully, false otherwise.
-    bool success = true;
+    // Give every stripe a row in the shared-memory stats, if there are any.
+    StatsSegment* stats_segment = nullptr;
+    if (options.shm) {
+        stats_segment = open_stats_segment(options.shm);
+        if (!stats_segment) return transfer_error(options, "Cannot open shared-memory stats " + string(options.shm));
+    }
 
-    // Send each frame.
-    for (size_t i = 0; i < frames.size(); ++i) {
-        Frame& frame = frames[i];
-        bool acked = false;
-
-        int attempts;
-        // Attempt to send frame until success, up to MAX_ATTEMPTS times.
-        for (attempts = 1; attempts <= MAX_ATTEMPTS; attempts++) {
-            // Send frame.
-            send(sock, &frame, sizeof(FrameHeader) + frame.header.payload_length, 0);
-
-            // Try to receive an ACK.
-            Frame response;
-            timeval tv{timeout, 0};
-            if (
-                receive_frame(sock, tv, response) &&
-                !is_noise_frame(response) &&
-                response.header.seq_number == frame.header.seq_number &&
-                is_my_source_id(response)
-            ) {
-                // ACKED; wait `slot_time` and move on to next frame.
-                wait_and_drop_frames(slot_time, sock);
-                acked = true;
-                break;
-            }
-            // Not ACKED; use backoff and retry.
-            uniform_int_distribution<int> backoff_dist = uniform_int_distribution<int>(0, (1 << min(attempts, 10)) - 1);
-            int backoff_time = backoff_dist(rng) * slot_time;
-            wait_and_drop_frames(backoff_time, sock);
+    // Connect every stripe to the channel, then send all of them concurrently.
+    Transfer transfer{frames, arrival_ms, options, slot_time, timeout_us, tracker, {}, {}, {},
+                      vector<uint8_t>(frames.size(), 0)};
+    if (options.samples) {
+        if (!open_sampler(transfer.sampler, options.samples, options.samples_json)) {
+            return transfer_error(options, "Cannot create samples file " + string(options.samples));
         }
+        transfer.sampler.interval_ms = options.sample_interval;
+        transfer.sampler.live = options.samples_live;
+    }
+    for (int k = 0; k < options.stripes; k++) {
+        Stripe stripe;
+        stripe.index = k;
+        stripe.sock = connect_to_channel(ip, port);
+        stripe.rng.seed(seed + k);
+        // Start on a sub-channel that spreads the stripes and the senders.
+        stripe.sense.collision_rate.assign(options.subchannels, 0);
+        // Seeds may be negative; keep the index non-negative.
+        stripe.sense.current = ((seed + k) % options.subchannels + options.subchannels) % options.subchannels;
+        stripe.max_backoff_exp = options.max_backoff_exp >= 0 ? options.max_backoff_exp
+                                                               : class_params[options.traffic_class].max_backoff_exp;
+        stripe.next = k;
+        stripe.rto.rto = timeout_us;
+        stripe.stat = claim_stat_slot(stats_segment, STAT_SENDER, "server " + to_string(getpid()) + " stripe " + to_string(k));
+        transfer.stripes.push_back(stripe);
+    }
 #ifdef DEBUG
-        cout << "Acked: " << acked << endl;
+    cout << "connected" << endl;
 #endif
+    run_transfer(transfer);
+    close_checkpoint(tracker.checkpoint);
+    close_sampler(transfer.sampler);
+    vector<SendStats> stripe_stats;
+    for (auto& stripe : transfer.stripes) {
+        stripe.stats.subchannel_hops = stripe.sense.hops;
+        stripe.stats.srtt_us = stripe.rto.srtt;
+        stripe_stats.push_back(stripe.stats);
+        release_stat_slot(stripe.stat);
+        close(stripe.sock);
+    }
 
-        // Update statistics after frame was (maybe) sent.
-        total_transmissions += attempts;
-        max_trans_per_frame = max(max_trans_per_frame, attempts);
-
-        // Stop if frame was not sent.
-        if (!acked) {
-            success = false;
-            break;
-        }
+    // Combine the statistics of all stripes.
+    int total_transmissions = 0;
+    int max_trans_per_frame = 0;
+    int frames_parked = 0;
+    int frames_recovered = 0;
+    int retransmissions_from_queue = 0;
+    int subchannel_hops = 0;
+    int ack_timeouts = 0;
+    double srtt_us = 0;
+    int frames_dropped = 0;
+    double total_delay_ms = 0;
+    int burst_frames = 0;
+    int deferrals = 0;
+    int tree_splits = 0;
+    int fec_repairs = 0;
+    int fec_erased = 0;
+    int fec_recoverable = 0;
+    int fec_unrecovered = 0;
+    ByteAccounting account;
+    bool success = true;
+    for (auto& stats : stripe_stats) {
+        total_transmissions += stats.total_transmissions;
+        max_trans_per_frame = max(max_trans_per_frame, stats.max_trans_per_frame);
+        frames_parked += stats.frames_parked;
+        frames_recovered += stats.frames_recovered;
+        retransmissions_from_queue += stats.retransmissions_from_queue;
+        subchannel_hops += stats.subchannel_hops;
+        ack_timeouts += stats.ack_timeouts;
+        srtt_us += stats.srtt_us / stripe_stats.size();
+        frames_dropped += stats.frames_dropped;
+        total_delay_ms += stats.total_delay_ms;
+        burst_frames += stats.burst_frames;
+        deferrals += stats.deferrals;
+        tree_splits += stats.tree_splits;
+        fec_repairs += stats.fec_repairs;
+        fec_erased += stats.fec_erased;
+        fec_recoverable += stats.fec_recoverable;
+        fec_unrecovered += stats.fec_unrecovered;
+        merge_accounting(account, stats.account);
+        success = success && stats.success;
     }
 
     // Calculate total runtime of server.
     auto end = chrono::steady_clock::now();
-    int duration = chrono::duration_cast<chrono::milliseconds>(end - start).count();
+    int64_t duration_us = chrono::duration_cast<chrono::microseconds>(end - start).count();
+    int duration = duration_us / 1000;
 
     // Log the results ('Sent file', 'Result', 'File size', 'Total transfer time', 'Transmissions/frame', 'Average bandwidth').
     cerr << "Sent file: " << filename << endl;
     cerr << "Result: " << (success ? "Success :)" : "Failure :(") << endl;
     cerr << "File size: " << file_size << " Bytes (" << frames.size() << " frames)" << endl;
+    if (options.stripes > 1) {
+        cerr << "Stripes: " << options.stripes << " (" << tracker.frames_acked << " frames acked)" << endl;
+    }
+    if (resumed > 0) {
+        cerr << "Resumed: " << resumed << " frames were already acked" << endl;
+    }
+    if (frames_parked > 0) {
+        cerr << "Retry queue: " << frames_parked << " frames parked, " << frames_recovered << " recovered using "
+             << retransmissions_from_queue << " of " << options.retry_budget << " retry transmissions" << endl;
+    }
+    if (options.traffic.model != TRAFFIC_FILE) {
+        cerr << "Generated traffic: " << options.traffic.rate << " frames/slot, " << frames.size() << " frames, "
+             << frames_dropped << " dropped on a full backlog, average delay "
+             << total_delay_ms / max((size_t)tracker.frames_acked, (size_t)1) << " milliseconds" << endl;
+    }
+    if (options.hop) {
+        cerr << "Sub-channel hops: " << subchannel_hops << endl;
+    }
+    if (options.burst > 1) {
+        cerr << "Bursts: " << burst_frames << " frames sent within a burst, without contending, " << deferrals
+             << " deferred for other bursts" << endl;
+    }
+    if (options.tree) {
+        cerr << "Tree splitting: " << tree_splits << " splits after collisions" << endl;
+    }
+    if (options.fec_k > 0) {
+        cerr << "FEC: " << fec_repairs << " repair frames for blocks of " << options.fec_k << ", " << fec_erased
+             << " frames lost (" << fec_recoverable << " recoverable by the receivers, " << fec_unrecovered
+             << " not), all retransmitted" << endl;
+    }
+    cerr << "ACK timeouts: " << ack_timeouts;
+    if (options.adaptive_rto) cerr << " (smoothed ACK latency " << srtt_us << " microseconds)";
+    cerr << endl;
     cerr << "Total transfer time: " << duration << " milliseconds" << endl;
-    cerr << "Transmissions/frame: average " << (double)total_transmissions / frames.size() << ", maximum " << max_trans_per_frame << endl;
-    cerr << "Average bandwidth: " << (frames.size() * frames[0].header.payload_length * 8.0) / (duration * 1000.0) << " Mbps" << endl;
+    cerr << "Transmissions/frame: average " << (double)total_transmissions / max(frames.size() - resumed - frames_dropped, (size_t)1) << ", maximum " << max_trans_per_frame << endl;
+    cerr << "Average bandwidth: " << rate_mbps(account.goodput_bytes, duration_us) << " Mbps (goodput: "
+         << account.goodput_bytes << " payload bytes in " << account.goodput_frames << " acked frames)" << endl;
+    cerr << "Wire throughput: " << rate_mbps(account.wire_bytes, duration_us) << " Mbps (" << account.wire_bytes
+         << " bytes in " << account.wire_frames << " frames, headers and retransmissions included)" << endl;
+    cerr << "Received: " << account.received_bytes << " bytes in " << account.received_frames << " frames, "
+         << account.discarded_bytes << " bytes in " << account.discarded_frames << " frames discarded" << endl;
+    // Each stripe accounts its own time, so the phases add up to the stripes' total running time.
+    int64_t accounted_us = 0;
+    for (int p = 0; p < NUM_PHASES; p++) accounted_us += account.phase_us[p];
+    cerr << "Time (over all stripes):";
+    for (int p = 0; p < NUM_PHASES; p++) {
+        cerr << (p ? ", " : " ") << phase_names[p] << " " << account.phase_us[p] / 1000.0 << " ms ("
+             << 100.0 * account.phase_us[p] / max(accounted_us, (int64_t)1) << "%)";
+    }
+    cerr << endl;
+    if (!options.json) return success;
 
-    close(sock);
+    // Write the same results, with every parameter and counter, as one JSON object.
+    ofstream json_file;
+    if (string(options.json) != "-") {
+        json_file.open(options.json);
+        if (!json_file) {
+            cerr << "Error: Cannot create JSON report " << options.json << endl;
+            return success;
+        }
+    }
+    const char* model_names[] = {"file", "cbr", "poisson", "onoff"};
+    JsonWriter json{json_file.is_open() ? (ostream&)json_file : cout, {}};
+    json_begin_object(json);
+    json_value(json, "program", "server");
+    json_begin_object(json, "options");
+    json_value(json, "channel_ip", ip);
+    json_value(json, "channel_port", port);
+    json_value(json, "file", filename);
+    json_value(json, "frame_size", frame_size);
+    json_value(json, "slot_time_ms", slot_time);
+    json_value(json, "seed", seed);
+    json_value(json, "timeout_us", timeout_us);
+    json_value(json, "stripes", options.stripes);
+    json_value(json, "checkpoint", options.checkpoint);
+    json_value(json, "resume", options.resume);
+    json_value(json, "retry_budget", options.retry_budget);
+    json_value(json, "class", class_params[options.traffic_class].name);
+    json_value(json, "backoff_cap", options.max_backoff_exp >= 0 ? options.max_backoff_exp
+                                                                  : class_params[options.traffic_class].max_backoff_exp);
+    json_value(json, "subchannels", options.subchannels);
+    json_value(json, "hop", options.hop);
+    json_value(json, "adaptive_rto", options.adaptive_rto);
+    json_value(json, "traffic", model_names[options.traffic.model]);
+    json_value(json, "rate", options.traffic.rate);
+    json_value(json, "duration_slots", options.traffic.duration);
+    json_value(json, "mean_on", options.traffic.mean_on);
+    json_value(json, "mean_off", options.traffic.mean_off);
+    json_value(json, "pareto_alpha", options.traffic.pareto_alpha);
+    json_value(json, "burst", options.burst);
+    json_value(json, "burst_bytes", options.burst_bytes);
+    json_value(json, "tree", options.tree);
+    json_value(json, "fec_k", options.fec_k);
+    json_value(json, "fec_r", options.fec_r);
+    json_end_object(json);
+    json_value(json, "success", success);
+    json_value(json, "file_size", file_size);
+    json_value(json, "frames", frames.size());
+    json_value(json, "frames_acked", (uint64_t)tracker.frames_acked);
+    json_value(json, "frames_resumed", resumed);
+    json_value(json, "frames_parked", frames_parked);
+    json_value(json, "frames_recovered", frames_recovered);
+    json_value(json, "retransmissions_from_queue", retransmissions_from_queue);
+    json_value(json, "frames_dropped", frames_dropped);
+    json_value(json, "average_delay_ms", total_delay_ms / max((size_t)tracker.frames_acked, (size_t)1));
+    json_value(json, "subchannel_hops", subchannel_hops);
+    json_value(json, "burst_frames", burst_frames);
+    json_value(json, "deferrals", deferrals);
+    json_value(json, "tree_splits", tree_splits);
+    json_value(json, "fec_repairs", fec_repairs);
+    json_value(json, "fec_erased", fec_erased);
+    json_value(json, "fec_recoverable", fec_recoverable);
+    json_value(json, "fec_unrecovered", fec_unrecovered);
+    json_value(json, "ack_timeouts", ack_timeouts);
+    json_value(json, "srtt_us", srtt_us);
+    json_value(json, "transfer_time_us", duration_us);
+    json_value(json, "transmissions", total_transmissions);
+    json_value(json, "max_transmissions_per_frame", max_trans_per_frame);
+    json_value(json, "goodput_mbps", rate_mbps(account.goodput_bytes, duration_us));
+    json_value(json, "goodput_bytes", account.goodput_bytes);
+    json_value(json, "wire_mbps", rate_mbps(account.wire_bytes, duration_us));
+    json_value(json, "wire_bytes", account.wire_bytes);
+    json_value(json, "wire_frames", account.wire_frames);
+    json_value(json, "received_bytes", account.received_bytes);
+    json_value(json, "received_frames", account.received_frames);
+    json_value(json, "discarded_bytes", account.discarded_bytes);
+    json_value(json, "discarded_frames", account.discarded_frames);
+    json_begin_object(json, "phase_us");
+    for (int p = 0; p < NUM_PHASES; p++) json_value(json, phase_names[p], account.phase_us[p]);
+    json_end_object(json);
+    json_begin_array(json, "stripes");
+    for (auto& stats : stripe_stats) {
+        json_begin_object(json);
+        json_value(json, "success", stats.success);
+        json_value(json, "frames_acked", stats.account.goodput_frames);
+        json_value(json, "transmissions", stats.total_transmissions);
+        json_value(json, "collisions", stats.collisions);
+        json_value(json, "ack_timeouts", stats.ack_timeouts);
+        json_value(json, "frames_dropped", stats.frames_dropped);
+        json_value(json, "subchannel_hops", stats.subchannel_hops);
+        json_value(json, "srtt_us", stats.srtt_us);
+        json_end_object(json);
+    }
+    json_end_array(json);
+    json_end_object(json);
+    json.out.flush();
+    return success;
+}
+
+// Gets the timeout argument: a number of seconds, or of milliseconds or
+// microseconds when followed by "ms" or "us".
+// Returns it in microseconds, or -1 if it is malformed.
+int64_t parse_timeout_us(const string& text) {
+    size_t end;
+    int64_t value;
+    try {
+        value = stoll(text, &end);
+    } catch (const exception&) {
+        return -1;
+    }
+    string unit = text.substr(end);
+    if (unit == "" || unit == "s") return value * 1000000;
+    if (unit == "ms") return value * 1000;
+    if (unit == "us") return value;
+    return -1;
+}
+
+// Gets the optional arguments that follow the positional ones (argv[first] onwards).
+// Parses them into `options`.
+// Returns true on success, or false if an option is unknown or invalid.
+bool parse_options(int argc, char* argv[], int first, ServerOptions& options) {
+    for (int i = first; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--stripes" && i + 1 < argc) {
+            options.stripes = stoi(argv[++i]);
+            if (options.stripes < 1 || options.stripes > 255) return false;
+        } else if (arg == "--checkpoint" && i + 1 < argc) {
+            options.checkpoint = argv[++i];
+        } else if (arg == "--retry-budget" && i + 1 < argc) {
+            options.retry_budget = stoi(argv[++i]);
+            if (options.retry_budget < 0) return false;
+        } else if (arg == "--class" && i + 1 < argc) {
+            string name = argv[++i];
+            options.traffic_class = -1;
+            for (int c = 0; c < NUM_CLASSES; c++) {
+                if (name == class_params[c].name) options.traffic_class = c;
+            }
+            if (options.traffic_class < 0) return false;
+        } else if (arg == "--backoff-cap" && i + 1 < argc) {
+            options.max_backoff_exp = stoi(argv[++i]);
+            if (options.max_backoff_exp < 0 || options.max_backoff_exp > 16) return false;
+        } else if (arg == "--source-id" && i + 1 < argc) {
+            if (!parse_id(argv[++i], base_source_id)) return false;
+        } else if (arg == "--dest-id" && i + 1 < argc) {
+            if (!parse_id(argv[++i], options.dest_id)) return false;
+            options.has_dest_id = true;
+        } else if (arg == "--subchannels" && i + 1 < argc) {
+            options.subchannels = stoi(argv[++i]);
+            if (options.subchannels < 1 || options.subchannels > 256) return false;
+        } else if (arg == "--hop") {
+            options.hop = true;
+        } else if (arg == "--adaptive-rto") {
+            options.adaptive_rto = true;
+        } else if (arg == "--resume") {
+            options.resume = true;
+        } else if (arg == "--traffic" && i + 1 < argc) {
+            if (!parse_traffic_model(argv[++i], options.traffic.model)) return false;
+        } else if (arg == "--rate" && i + 1 < argc) {
+            options.traffic.rate = stod(argv[++i]);
+            if (options.traffic.rate <= 0) return false;
+        } else if (arg == "--duration" && i + 1 < argc) {
+            options.traffic.duration = stod(argv[++i]);
+            if (options.traffic.duration <= 0) return false;
+        } else if (arg == "--on-off" && i + 2 < argc) {
+            options.traffic.mean_on = stod(argv[++i]);
+            options.traffic.mean_off = stod(argv[++i]);
+            if (options.traffic.mean_on <= 0 || options.traffic.mean_off < 0) return false;
+        } else if (arg == "--pareto" && i + 1 < argc) {
+            options.traffic.pareto_alpha = stod(argv[++i]);
+            if (options.traffic.pareto_alpha <= 1) return false;
+        } else if (arg == "--shm" && i + 1 < argc) {
+            options.shm = argv[++i];
+        } else if (arg == "--samples" && i + 1 < argc) {
+            options.samples = argv[++i];
+        } else if (arg == "--sample-interval" && i + 1 < argc) {
+            options.sample_interval = stoi(argv[++i]);
+            if (options.sample_interval < 1) return false;
+        } else if (arg == "--sample-format" && i + 1 < argc) {
+            string format = argv[++i];
+            if (format != "csv" && format != "json") return false;
+            options.samples_json = format == "json";
+        } else if (arg == "--sample-live") {
+            options.samples_live = true;
+        } else if (arg == "--burst" && i + 1 < argc) {
+            options.burst = stoi(argv[++i]);
+            if (options.burst < 1) return false;
+        } else if (arg == "--burst-bytes" && i + 1 < argc) {
+            // stoul would wrap a negative value around to a huge limit.
+            long long bytes = stoll(argv[++i]);
+            if (bytes < 1 || bytes > UINT32_MAX) return false;
+            options.burst_bytes = bytes;
+        } else if (arg == "--tree") {
+            options.tree = true;
+        } else if (arg == "--fec" && i + 2 < argc) {
+            options.fec_k = stoi(argv[++i]);
+            options.fec_r = stoi(argv[++i]);
+            if (options.fec_k < 1 || options.fec_r < 1 || options.fec_k + options.fec_r > FEC_MAX_SHARDS) return false;
+        } else if (arg == "--json" && i + 1 < argc) {
+            options.json = argv[++i];
+        } else {
+            return false;
+        }
+    }
+    // Bursts would keep the other senders from following the collision resolution.
+    return !(options.tree && options.burst > 1);
 }
 
 int main(int argc, char* argv[]) {
-    if (argc != 8) {
-        cerr << "Usage: ./my_Server <chan_ip> <chan_port> <file_name> <frame_size> <slot_time> <seed> <timeout>" << endl;
+    ServerOptions options;
+    if (argc < 8 || !parse_options(argc, argv, 8, options)) {
+        cerr << "Usage: ./my_Server <chan_ip> <chan_port> <file_name> <frame_size> <slot_time> <seed> <timeout>"
+                " [--stripes K] [--checkpoint PATH [--resume]] [--retry-budget N]"
+                " [--class bulk|control] [--backoff-cap E] [--source-id ID] [--dest-id ID]"
+                " [--subchannels K [--hop]] [--adaptive-rto]"
+                " [--traffic file|cbr|poisson|onoff [--rate R] [--duration SLOTS] [--on-off ON OFF] [--pareto A]] [--shm NAME]"
+                " [--samples PATH [--sample-interval MS] [--sample-format csv|json] [--sample-live]]"
+                " [--json PATH|-] [--burst K [--burst-bytes B] | --tree] [--fec K R]" << endl;
+        cerr << "<timeout> is in seconds, or in milliseconds/microseconds with an 'ms'/'us' suffix." << endl;
         return 1;
     }
-    if (stoi(argv[4]) > MAX_PAYLOAD_SIZE) {
+    if (options.resume && !options.checkpoint) {
+        cerr << "Error: --resume requires --checkpoint." << endl;
+        return 1;
+    }
+    if (options.checkpoint && options.traffic.model != TRAFFIC_FILE) {
+        cerr << "Error: --checkpoint only applies to sending a file." << endl;
+        return 1;
+    }
+    int64_t timeout_us = parse_timeout_us(argv[7]);
+    if (timeout_us <= 0) {
+        cerr << "Error: Invalid timeout " << argv[7] << "." << endl;
+        return 1;
+    }
+    if (stoi(argv[4]) > (int)MAX_PAYLOAD_SIZE) {
         cerr << "Error: Frame size too large. Maximum is " << MAX_PAYLOAD_SIZE << " bytes." << endl;
         return 1;
     }
-    send_file(argv[1], stoi(argv[2]), argv[3], stoi(argv[4]), stoi(argv[5]), stoi(argv[6]), stoi(argv[7]));
-    return 0;
+    if (options.fec_k > 0 && stoi(argv[4]) > (int)fec_max_data_size(options.fec_k)) {
+        cerr << "Error: Frame size too large for --fec " << options.fec_k << ". Maximum is "
+             << fec_max_data_size(options.fec_k) << " bytes." << endl;
+        return 1;
+    }
+    bool success = send_file(argv[1], stoi(argv[2]), argv[3], stoi(argv[4]), stoi(argv[5]), stoi(argv[6]), timeout_us, options);
+    return success ? 0 : 1;
 }
@@ -0,0 +1,107 @@
+// session_log.h
+#ifndef SESSION_LOG_H
+#define SESSION_LOG_H
+
+#include "protocol.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SESSION_LOG_MAGIC "alohalg1"
+
+// Kinds of events in a session log.
+#define EVENT_CONNECT 1         // a server connected; `address` and `port` are set
+#define EVENT_ARRIVAL 2         // a frame arrived from a server; `header` and `payload_hash` are set
+#define EVENT_CLOSE 3           // a server disconnected or was evicted; `address` holds the reason (CLOSE_*)
+#define EVENT_END 4             // the channel was stopped
+#define EVENT_TICK 5            // the channel woke up with nothing to read (switch or slotted mode only)
+#define EVENT_KICK 6            // an admin disconnected a server
+#define EVENT_RESET 7           // an admin reset the statistics
+#define EVENT_SLOT_TIME 8       // an admin changed the slot time; `address` holds the new one
+#define EVENT_MODE 9            // an admin changed the modes; `address` holds them (fair, priority, slotted bits)
+
+// Why a server's connection ended, as recorded with EVENT_CLOSE.
+#define CLOSE_EOF 0             // the server closed it
+#define CLOSE_ERROR 1           // receiving from or sending to the server failed
+#define CLOSE_MALFORMED 2       // the server sent an impossible frame header
+#define CLOSE_IDLE 3            // the server stayed silent for longer than the idle timeout
+
+// First record of a session log, describing the channel that wrote it.
+struct SessionLogHeader {
+    char magic[8];
+    uint32_t slot_time;         // in milliseconds
+    int32_t seed;
+};
+
+// One event of a session log.
+// Arrivals handled in the same wake of the channel share a `wake` number,
+// so that a replay sees exactly the same collisions.
+struct SessionRecord {
+    uint64_t time_us;           // time since the channel started
+    uint32_t wake;              // number of the channel's wake the event happened in
+    uint16_t server;            // index of the server in the channel's list
+    uint8_t event;              // EVENT_*
+    uint8_t reserved = 0;
+    uint32_t address = 0;       // IPv4 address of the server (network byte order) on connect, the new setting, or the reason of a close
+    uint16_t port = 0;          // TCP port of the server (network byte order)
+    uint16_t reserved2 = 0;
+    FrameHeader header{};
+    uint64_t payload_hash = 0;  // FNV-1a hash of the payload
+};
+
+// Gets a frame.
+// Returns a 64-bit FNV-1a hash of its payload.
+inline uint64_t hash_payload(const Frame& frame) {
+    uint64_t hash = 1469598103934665603ULL;
+    for (uint32_t i = 0; i < frame.header.payload_length && i < MAX_PAYLOAD_SIZE; i++) {
+        hash ^= (uint8_t)frame.payload[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Gets a path, and the slot time and seed of the channel.
+// Creates a session log there and writes its header.
+// Returns the open file, or nullptr on failure.
+inline FILE* create_session_log(const char* path, uint32_t slot_time, int32_t seed) {
+    FILE* file = fopen(path, "wb");
+    if (!file) return nullptr;
+    SessionLogHeader header;
+    memcpy(header.magic, SESSION_LOG_MAGIC, sizeof(header.magic));
+    header.slot_time = slot_time;
+    header.seed = seed;
+    if (fwrite(&header, sizeof(header), 1, file) != 1) {
+        fclose(file);
+        return nullptr;
+    }
+    return file;
+}
+
+// Gets a path.
+// Opens the session log there and reads its header into `header`.
+// Returns the open file positioned at the first record, or nullptr if the
+// file cannot be read or is not a session log.
+inline FILE* open_session_log(const char* path, SessionLogHeader& header) {
+    FILE* file = fopen(path, "rb");
+    if (!file) return nullptr;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, SESSION_LOG_MAGIC, sizeof(header.magic)) != 0) {
+        fclose(file);
+        return nullptr;
+    }
+    return file;
+}
+
+// Appends a record to a session log.
+// Records are buffered by stdio; the log is complete once it is closed.
+inline void write_session_record(FILE* file, const SessionRecord& record) {
+    fwrite(&record, sizeof(record), 1, file);
+}
+
+// Reads the next record of a session log.
+// Returns true on success, or false at the end of the log.
+inline bool read_session_record(FILE* file, SessionRecord& record) {
+    return fread(&record, sizeof(record), 1, file) == 1;
+}
+
+#endif
@@ -0,0 +1,196 @@
+// shm_stats.h
+#ifndef SHM_STATS_H
+#define SHM_STATS_H
+
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <atomic>
+#include <string>
+
+#define SHM_STATS_MAGIC 0x414c4f4841535431ULL     // "ALOHAST1"
+#define SHM_STATS_SLOTS 1024
+#define SHM_STATS_NAME_SIZE 40
+
+// What a stats slot describes.
+#define STAT_FREE 0
+#define STAT_CHANNEL 1          // a channel's totals: frames = successful slots, collisions = collision slots,
+                                // transmissions = frames received, bytes = payload bytes delivered
+#define STAT_PORT 2             // one connection of a channel: frames and bytes delivered, collisions, drops
+#define STAT_SENDER 3           // one stripe of a server: frames acked, bytes acked, collisions (noise heard),
+                                // transmissions, ack timeouts, drops (generated frames dropped)
+
+// Counters of a stats slot. Each slot has a single writer, so the writer
+// updates them with plain (relaxed) stores inside the slot's seqlock.
+struct StatCounters {
+    std::atomic<uint64_t> frames{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> collisions{0};
+    std::atomic<uint64_t> transmissions{0};
+    std::atomic<uint64_t> ack_timeouts{0};
+    std::atomic<uint64_t> drops{0};
+};
+
+// Plain copy of the counters of a slot, as read by a viewer or set by a writer.
+struct StatValues {
+    uint64_t frames = 0;
+    uint64_t bytes = 0;
+    uint64_t collisions = 0;
+    uint64_t transmissions = 0;
+    uint64_t ack_timeouts = 0;
+    uint64_t drops = 0;
+};
+
+// One row of the stats table, owned by one process.
+struct StatSlot {
+    std::atomic<uint32_t> seq{0};       // odd while the owner is writing
+    std::atomic<int32_t> owner{0};      // process ID of the owner, or 0 if the slot is free
+    std::atomic<uint32_t> kind{STAT_FREE};
+    char name[SHM_STATS_NAME_SIZE];     // written under the seqlock when the slot is claimed
+    StatCounters counters;
+};
+
+// The shared-memory segment: a header and a fixed table of slots.
+struct StatsSegment {
+    std::atomic<uint64_t> magic;
+    uint32_t slot_count;
+    StatSlot slots[SHM_STATS_SLOTS];
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared counters must be lock-free");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "shared sequence numbers must be lock-free");
+
+// Gets the name of a stats segment.
+// Returns it as a POSIX shared memory name (with a leading '/').
+inline std::string shm_stats_path(const char* name) {
+    return name[0] == '/' ? std::string(name) : "/" + std::string(name);
+}
+
+// Gets the name of a stats segment.
+// Maps the segment for writing, creating it if it does not exist yet.
+// Returns the segment, or nullptr on failure.
+inline StatsSegment* open_stats_segment(const char* name) {
+    int fd = shm_open(shm_stats_path(name).c_str(), O_CREAT | O_RDWR, 0666);
+    if (fd == -1) return nullptr;
+    // A new segment is zero-filled; growing an existing one of the same size changes nothing.
+    if (ftruncate(fd, sizeof(StatsSegment)) == -1) {
+        close(fd);
+        return nullptr;
+    }
+    void* addr = mmap(nullptr, sizeof(StatsSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) return nullptr;
+    StatsSegment* segment = (StatsSegment*)addr;
+    uint64_t expected = 0;
+    if (segment->magic.compare_exchange_strong(expected, SHM_STATS_MAGIC)) {
+        segment->slot_count = SHM_STATS_SLOTS;
+    } else if (expected != SHM_STATS_MAGIC) {
+        munmap(addr, sizeof(StatsSegment));
+        return nullptr;
+    }
+    return segment;
+}
+
+// Gets the name of a stats segment.
+// Maps the segment read-only, for a viewer.
+// Returns the segment, or nullptr if it does not exist or is not a stats segment.
+inline const StatsSegment* view_stats_segment(const char* name) {
+    int fd = shm_open(shm_stats_path(name).c_str(), O_RDONLY, 0);
+    if (fd == -1) return nullptr;
+    void* addr = mmap(nullptr, sizeof(StatsSegment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) return nullptr;
+    const StatsSegment* segment = (const StatsSegment*)addr;
+    if (segment->magic.load() != SHM_STATS_MAGIC) {
+        munmap(addr, sizeof(StatsSegment));
+        return nullptr;
+    }
+    return segment;
+}
+
+// Checks if the owner of a slot is still running.
+inline bool stat_owner_alive(int32_t owner) {
+    return owner != 0 && (kill(owner, 0) == 0 || errno == EPERM);
+}
+
+// Gets a segment, and the kind and name of a new row.
+// Claims a free slot (or one whose owner died) for this process.
+// Returns the slot, or nullptr if the table is full (or there is no segment).
+inline StatSlot* claim_stat_slot(StatsSegment* segment, uint32_t kind, const std::string& name) {
+    if (!segment) return nullptr;
+    int32_t self = getpid();
+    for (auto& slot : segment->slots) {
+        int32_t owner = slot.owner.load();
+        if (owner != 0 && stat_owner_alive(owner)) continue;
+        if (!slot.owner.compare_exchange_strong(owner, self)) continue;
+        slot.kind.store(STAT_FREE);
+        // A dead owner may have left the sequence number odd, in the middle of a write.
+        uint32_t seq = slot.seq.load() | 1;
+        slot.seq.store(seq);
+        strncpy(slot.name, name.c_str(), SHM_STATS_NAME_SIZE - 1);
+        slot.name[SHM_STATS_NAME_SIZE - 1] = 0;
+        slot.counters.frames.store(0, std::memory_order_relaxed);
+        slot.counters.bytes.store(0, std::memory_order_relaxed);
+        slot.counters.collisions.store(0, std::memory_order_relaxed);
+        slot.counters.transmissions.store(0, std::memory_order_relaxed);
+        slot.counters.ack_timeouts.store(0, std::memory_order_relaxed);
+        slot.counters.drops.store(0, std::memory_order_relaxed);
+        slot.seq.store(seq + 1, std::memory_order_release);
+        slot.kind.store(kind, std::memory_order_release);
+        return &slot;
+    }
+    return nullptr;
+}
+
+// Gives a slot back to the table.
+inline void release_stat_slot(StatSlot* slot) {
+    if (!slot) return;
+    slot->kind.store(STAT_FREE);
+    slot->owner.store(0);
+}
+
+// Gets a slot owned by this process and new values of its counters.
+// Publishes them: readers never see a mix of old and new values.
+inline void publish_stats(StatSlot* slot, const StatValues& values) {
+    if (!slot) return;
+    uint32_t seq = slot->seq.load(std::memory_order_relaxed);
+    slot->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot->counters.frames.store(values.frames, std::memory_order_relaxed);
+    slot->counters.bytes.store(values.bytes, std::memory_order_relaxed);
+    slot->counters.collisions.store(values.collisions, std::memory_order_relaxed);
+    slot->counters.transmissions.store(values.transmissions, std::memory_order_relaxed);
+    slot->counters.ack_timeouts.store(values.ack_timeouts, std::memory_order_relaxed);
+    slot->counters.drops.store(values.drops, std::memory_order_relaxed);
+    slot->seq.store(seq + 2, std::memory_order_release);
+}
+
+// Gets a slot.
+// Copies a consistent snapshot of its name and counters into `name` (of
+// SHM_STATS_NAME_SIZE bytes) and `values`, retrying while its owner writes.
+// Returns true on success, or false if the owner seems to have died while writing.
+inline bool read_stats(const StatSlot& slot, char* name, StatValues& values) {
+    for (int attempt = 0; attempt < 100000; attempt++) {
+        uint32_t before = slot.seq.load(std::memory_order_acquire);
+        if (before & 1) continue;
+        for (int i = 0; i < SHM_STATS_NAME_SIZE; i++) {
+            name[i] = ((const volatile char*)slot.name)[i];
+        }
+        name[SHM_STATS_NAME_SIZE - 1] = 0;
+        values.frames = slot.counters.frames.load(std::memory_order_relaxed);
+        values.bytes = slot.counters.bytes.load(std::memory_order_relaxed);
+        values.collisions = slot.counters.collisions.load(std::memory_order_relaxed);
+        values.transmissions = slot.counters.transmissions.load(std::memory_order_relaxed);
+        values.ack_timeouts = slot.counters.ack_timeouts.load(std::memory_order_relaxed);
+        values.drops = slot.counters.drops.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) == before) return true;
+    }
+    return false;
+}
+
+#endif
@@ -0,0 +1,97 @@
+// timer_wheel.h
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#define WHEEL_BITS 8
+#define WHEEL_BUCKETS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4
+
+// Hierarchical timer wheel holding items due at integer ticks (e.g. milliseconds).
+// Level 0 has one bucket per tick; each higher level has one bucket per
+// WHEEL_BUCKETS buckets of the level below. An item is stored in the lowest
+// level whose current block contains its due tick, and moves down a level
+// each time the wheel enters that block, so scheduling and expiring are O(1)
+// per item.
+// Items cannot be cancelled; owners ignore stale items instead (e.g. by
+// tagging them with a generation number).
+template <typename T>
+struct TimerWheel {
+    struct Entry {
+        uint64_t due;
+        T item;
+    };
+    std::vector<Entry> buckets[WHEEL_LEVELS][WHEEL_BUCKETS];
+    uint64_t now = 0;           // every tick before this one was already expired
+    size_t count = 0;           // number of items scheduled
+};
+
+// Gets a wheel and an entry due at or after the wheel's current tick.
+// Stores the entry in the bucket it belongs to.
+template <typename T>
+inline void wheel_place(TimerWheel<T>& wheel, const typename TimerWheel<T>::Entry& entry) {
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 &&
+           (entry.due >> (WHEEL_BITS * (level + 1))) != (wheel.now >> (WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+    wheel.buckets[level][(entry.due >> (WHEEL_BITS * level)) & (WHEEL_BUCKETS - 1)].push_back(entry);
+}
+
+// Gets a wheel, the tick an item is due at, and the item.
+// Schedules the item; ticks in the past are due at the next expiry.
+template <typename T>
+inline void wheel_schedule(TimerWheel<T>& wheel, uint64_t due, const T& item) {
+    if (due < wheel.now) due = wheel.now;
+    wheel_place(wheel, {due, item});
+    wheel.count++;
+}
+
+// Gets a wheel with items scheduled.
+// Returns the tick the earliest of them is due at (stale items included).
+template <typename T>
+inline uint64_t wheel_next_due(const TimerWheel<T>& wheel) {
+    // Every item of a level is due before those of the levels above it, and
+    // the buckets of a level are in due order from the current one to the end
+    // of its block, except on the top level, which may wrap around.
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        size_t first = level < WHEEL_LEVELS - 1 ? (wheel.now >> (WHEEL_BITS * level)) & (WHEEL_BUCKETS - 1) : 0;
+        uint64_t due = UINT64_MAX;
+        for (size_t i = first; i < WHEEL_BUCKETS; i++) {
+            for (auto& entry : wheel.buckets[level][i]) due = entry.due < due ? entry.due : due;
+            if (due != UINT64_MAX && level < WHEEL_LEVELS - 1) return due;
+        }
+        if (due != UINT64_MAX) return due;
+    }
+    return wheel.now;
+}
+
+// Gets a wheel and the current tick.
+// Moves the items due up to and including that tick to `expired`, in due order.
+template <typename T>
+inline void wheel_expire(TimerWheel<T>& wheel, uint64_t tick, std::vector<T>& expired) {
+    while (wheel.now <= tick && wheel.count > 0) {
+        // Expire the items of the current tick.
+        auto& bucket = wheel.buckets[0][wheel.now & (WHEEL_BUCKETS - 1)];
+        for (auto& entry : bucket) expired.push_back(entry.item);
+        wheel.count -= bucket.size();
+        bucket.clear();
+        wheel.now++;
+
+        // Entering a new block of a higher level moves that block's items down.
+        int top = 0;
+        while (top < WHEEL_LEVELS - 1 && (wheel.now & ((1ULL << (WHEEL_BITS * (top + 1))) - 1)) == 0) top++;
+        for (int level = top; level > 0; level--) {
+            auto& upper = wheel.buckets[level][(wheel.now >> (WHEEL_BITS * level)) & (WHEEL_BUCKETS - 1)];
+            std::vector<typename TimerWheel<T>::Entry> moving;
+            moving.swap(upper);
+            for (auto& entry : moving) wheel_place(wheel, entry);
+        }
+    }
+    if (wheel.now <= tick) wheel.now = tick + 1;
+}
+
+#endif
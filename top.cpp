@@ -0,0 +1,144 @@
+// top.cpp
+#include "shm_stats.h"
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <thread>
+
+using namespace std;
+
+// Options that may follow the program name on the command line.
+struct TopOptions {
+    const char* shm = "aloha_stats";   // name of the shared-memory stats segment
+    int interval_ms = 1000;             // time between two refreshes
+    bool once = false;                  // print a single table (with no rates) and exit
+};
+
+// One row of the table, as read at one refresh.
+struct TopRow {
+    size_t slot;                        // index of the slot in the segment
+    int32_t owner;
+    uint32_t kind;
+    string name;
+    StatValues values;
+};
+
+// Gets the kind of a slot.
+// Returns its name as shown in the table.
+const char* kind_name(uint32_t kind) {
+    switch (kind) {
+    case STAT_CHANNEL: return "channel";
+    case STAT_PORT: return "port";
+    case STAT_SENDER: return "sender";
+    default: return "?";
+    }
+}
+
+// Gets a segment.
+// Returns a snapshot of every slot in use by a running process, in slot order.
+vector<TopRow> read_rows(const StatsSegment* segment) {
+    vector<TopRow> rows;
+    for (size_t i = 0; i < SHM_STATS_SLOTS; i++) {
+        const StatSlot& slot = segment->slots[i];
+        TopRow row;
+        row.slot = i;
+        row.kind = slot.kind.load(memory_order_acquire);
+        row.owner = slot.owner.load();
+        if (row.kind == STAT_FREE || !stat_owner_alive(row.owner)) continue;
+        char name[SHM_STATS_NAME_SIZE];
+        if (!read_stats(slot, name, row.values)) continue;
+        row.name = name;
+        rows.push_back(row);
+    }
+    return rows;
+}
+
+// Gets the rows of the previous refresh and a row of this one.
+// Returns the previous snapshot of the same row, or nullptr if it is new.
+const TopRow* find_previous(const vector<TopRow>& previous, const TopRow& row) {
+    for (auto& old : previous) {
+        if (old.slot == row.slot && old.owner == row.owner && old.kind == row.kind && old.name == row.name) return &old;
+    }
+    return nullptr;
+}
+
+// Gets the rows of this refresh and of the previous one, and the seconds between them.
+// Prints the table: the counters of every row, and their rates when known.
+void print_table(const vector<TopRow>& rows, const vector<TopRow>& previous, double seconds) {
+    cout << left << setw(8) << "KIND" << setw(32) << "NAME" << right << setw(8) << "PID" << setw(10) << "FRAMES"
+         << setw(12) << "BYTES" << setw(10) << "COLL" << setw(10) << "TX" << setw(9) << "TIMEOUT" << setw(8) << "DROPS"
+         << setw(10) << "FRAMES/s" << setw(10) << "kbps" << setw(8) << "COLL%" << endl;
+    for (auto& row : rows) {
+        const StatValues& v = row.values;
+        cout << left << setw(8) << kind_name(row.kind) << setw(32) << row.name << right << setw(8) << row.owner
+             << setw(10) << v.frames << setw(12) << v.bytes << setw(10) << v.collisions << setw(10) << v.transmissions
+             << setw(9) << v.ack_timeouts << setw(8) << v.drops;
+        const TopRow* old = find_previous(previous, row);
+        if (old && seconds > 0) {
+            double frames = (v.frames - old->values.frames) / seconds;
+            double kbps = (v.bytes - old->values.bytes) * 8 / seconds / 1000;
+            // Share of the attempts (or, for a channel, of the busy slots) that collided.
+            uint64_t collisions = v.collisions - old->values.collisions;
+            uint64_t attempts = row.kind == STAT_SENDER ? v.transmissions - old->values.transmissions
+                                                        : collisions + (v.frames - old->values.frames);
+            cout << fixed << setprecision(1) << setw(10) << frames << setw(10) << kbps << setw(8)
+                 << (attempts ? 100.0 * collisions / attempts : 0.0) << defaultfloat;
+        }
+        cout << endl;
+    }
+    if (rows.empty()) cout << "(no running channel or server publishes to this segment)" << endl;
+}
+
+// Gets the arguments to the program.
+// Parses them into `options`.
+// Returns true on success, or false if an option is unknown or invalid.
+bool parse_options(int argc, char* argv[], TopOptions& options) {
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--shm" && i + 1 < argc) {
+            options.shm = argv[++i];
+        } else if (arg == "--interval" && i + 1 < argc) {
+            options.interval_ms = stoi(argv[++i]);
+            if (options.interval_ms < 10) return false;
+        } else if (arg == "--once") {
+            options.once = true;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    TopOptions options;
+    if (!parse_options(argc, argv, options)) {
+        cerr << "Usage: ./my_top [--shm NAME] [--interval MS] [--once]" << endl;
+        return 1;
+    }
+    const StatsSegment* segment = view_stats_segment(options.shm);
+    if (!segment) {
+        cerr << "Error: Cannot open shared-memory stats " << options.shm << endl;
+        return 1;
+    }
+    if (options.once) {
+        print_table(read_rows(segment), {}, 0);
+        return 0;
+    }
+    vector<TopRow> previous;
+    auto last = chrono::steady_clock::now();
+    while (true) {
+        vector<TopRow> rows = read_rows(segment);
+        auto now = chrono::steady_clock::now();
+        double seconds = chrono::duration<double>(now - last).count();
+        // Clear the screen and move the cursor home before redrawing.
+        cout << "\033[H\033[2J" << "Stats segment " << shm_stats_path(options.shm) << ", every "
+             << options.interval_ms << " ms" << endl << endl;
+        print_table(rows, previous, seconds);
+        cout << flush;
+        previous = rows;
+        last = now;
+        this_thread::sleep_for(chrono::milliseconds(options.interval_ms));
+    }
+}
@@ -0,0 +1,79 @@
+// traffic.h
+#ifndef TRAFFIC_H
+#define TRAFFIC_H
+
+#include "protocol.h"
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+
+// How frames are generated over time.
+enum TrafficModel {
+    TRAFFIC_FILE,       // the whole file is ready at once; frames go back-to-back
+    TRAFFIC_CBR,        // constant bit rate: one frame every 1/rate slots
+    TRAFFIC_POISSON,    // Poisson arrivals: exponential gaps with mean 1/rate slots
+    TRAFFIC_ONOFF,      // bursts: Poisson arrivals during exponential on periods, nothing during off periods
+};
+
+// Parameters of the generated traffic.
+struct TrafficOptions {
+    TrafficModel model = TRAFFIC_FILE;
+    double rate = 0.1;          // average frames per slot
+    double duration = 1000;     // slots over which frames are generated
+    double mean_on = 10;        // mean length of an on period, in slots (on/off only)
+    double mean_off = 90;       // mean length of an off period, in slots (on/off only)
+    double pareto_alpha = 0;    // shape of Pareto distributed frame sizes; 0 means fixed sizes
+};
+
+// Gets the name of a traffic model ("file", "cbr", "poisson" or "onoff").
+// Stores it in `model`.
+// Returns true on success, or false if the name is unknown.
+inline bool parse_traffic_model(const std::string& name, TrafficModel& model) {
+    if (name == "file") model = TRAFFIC_FILE;
+    else if (name == "cbr") model = TRAFFIC_CBR;
+    else if (name == "poisson") model = TRAFFIC_POISSON;
+    else if (name == "onoff") model = TRAFFIC_ONOFF;
+    else return false;
+    return true;
+}
+
+// Gets the traffic parameters and a random number generator.
+// Returns the arrival times of the frames, in slots from the start, in order.
+// The on/off model sends at rate * (mean_on + mean_off) / mean_on while on,
+// so that its average rate is still `rate`.
+inline std::vector<double> generate_arrivals(const TrafficOptions& traffic, std::default_random_engine& rng) {
+    std::vector<double> arrivals;
+    if (traffic.model == TRAFFIC_CBR) {
+        for (double t = 0; t < traffic.duration; t += 1 / traffic.rate) arrivals.push_back(t);
+    } else if (traffic.model == TRAFFIC_POISSON) {
+        std::exponential_distribution<double> gap(traffic.rate);
+        for (double t = gap(rng); t < traffic.duration; t += gap(rng)) arrivals.push_back(t);
+    } else if (traffic.model == TRAFFIC_ONOFF) {
+        std::exponential_distribution<double> on_length(1 / traffic.mean_on), off_length(1 / traffic.mean_off);
+        std::exponential_distribution<double> gap(traffic.rate * (traffic.mean_on + traffic.mean_off) / traffic.mean_on);
+        for (double start = 0; start < traffic.duration;) {
+            double end = std::min(traffic.duration, start + on_length(rng));
+            for (double t = start + gap(rng); t < end; t += gap(rng)) arrivals.push_back(t);
+            start = end + off_length(rng);
+        }
+    }
+    return arrivals;
+}
+
+// Gets the traffic parameters, the mean frame size and a random number generator.
+// Returns the payload length of the next generated frame: `frame_size`, or a
+// Pareto distributed size with that mean (capped at MAX_PAYLOAD_SIZE).
+inline uint32_t generate_frame_size(const TrafficOptions& traffic, uint32_t frame_size, std::default_random_engine& rng) {
+    if (traffic.pareto_alpha <= 0) return frame_size;
+    // Pareto with minimum x_m has mean alpha * x_m / (alpha - 1).
+    double x_m = frame_size * (traffic.pareto_alpha - 1) / traffic.pareto_alpha;
+    double u = std::uniform_real_distribution<double>(0, 1)(rng);
+    double size = x_m / std::pow(1 - u, 1 / traffic.pareto_alpha);
+    return (uint32_t)std::max(1.0, std::min(size, (double)MAX_PAYLOAD_SIZE));
+}
+
+#endif